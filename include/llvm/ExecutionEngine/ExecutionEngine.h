@@ -136,6 +136,9 @@ namespace llvm
 #else
 		std::map<void*, int> bytesAtPhysicalAddress;
 #endif
+		// findHeapObject - the base of the object in the given map that contains
+		// the address, or NULL; the maps are ordered by base address
+		static void *findHeapObject(const std::map<void*, int> &, void *);
 
 
 		SmallVector<Module*, 1> Modules;
@@ -1082,6 +1082,20 @@ void ExecutionEngineState::AddressMapConfig::onRAUW(
 			" RAUW on a value it has a global mapping for.");
 }
 
+// findHeapObject - Return the base address of the object in Objects that
+// contains addr, or NULL.  Live objects never overlap and freed ones are
+// erased, so the only candidate is the last object starting at or below addr.
+void *ExecutionEngine::findHeapObject(const std::map<void*, int> &Objects,
+		void *addr) {
+	std::map<void*, int>::const_iterator mit = Objects.upper_bound(addr);
+	if (mit == Objects.begin())
+		return NULL;
+	--mit;
+	if ((size_t)addr < (size_t)mit->first + mit->second)
+		return mit->first;
+	return NULL;
+}
+
 #if defined(VIRTUALMEMORY)
 void ExecutionEngine::virtualizeGlobalVariables() {
 	// write now we assume that it is not possible for a GlobalVariable to be in two different modules. I guess it is so, but we are not sure !
@@ -1119,17 +1133,7 @@ void ExecutionEngine::virtualizeGlobalVariables() {
 
 void *ExecutionEngine::getVirtualBaseAddressHeap(void *addr) {
 	// here we only work with virtual addresses
-	std::map<void*, int>::iterator mit;
-	int A,B,C;
-	C = (size_t)addr;
-	for(mit = bytesAtVirtualAddress.begin(); mit != bytesAtVirtualAddress.end(); ++mit) {
-		A = (size_t)mit->first;
-		B = A + mit->second;
-		if(C>=A && C<B) {
-			return mit->first;
-		}
-	}
-	return NULL;
+	return findHeapObject(bytesAtVirtualAddress, addr);
 }
 #else
 void ExecutionEngine::physicalizeGlobalVariables() {
@@ -1148,18 +1152,7 @@ void ExecutionEngine::physicalizeGlobalVariables() {
 }
 
 void *ExecutionEngine::getPhysicalBaseAddressHeap(void *addr) {
-  // here we only work with virtual addresses
-  std::map<void*, int>::iterator mit;
-  int A,B,C;
-  C = (size_t)addr;
-  for(mit = bytesAtPhysicalAddress.begin(); mit != bytesAtPhysicalAddress.end(); ++mit) {
-    A = (size_t)mit->first;
-    B = A + mit->second;
-    if(C>=A && C<B) {
-      return mit->first;
-    }
-  }
-  return NULL;
+  return findHeapObject(bytesAtPhysicalAddress, addr);
 }
 #endif
 
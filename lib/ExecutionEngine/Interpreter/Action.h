@@ -28,4 +28,23 @@ class Action {
 	   GenericValue pso_var; 	// the variable of whose buffer will be flushed for the given thread under PSO
 };
 
+// ScheduleEntity - Something a scheduler can run: a thread, or a store buffer,
+// which flushes its oldest store.  Under TSO a thread has one buffer and Addr
+// is NULL; under PSO it has one per address.
+struct ScheduleEntity {
+	int Tid;
+	bool Flush;
+	void *Addr;
+	ScheduleEntity(int tid = 0, bool flush = false, void *addr = 0)
+		: Tid(tid), Flush(flush), Addr(addr) {}
+	bool operator<(const ScheduleEntity &E) const {
+		if (Tid != E.Tid) return Tid < E.Tid;
+		if (Flush != E.Flush) return Flush < E.Flush;
+		return Addr < E.Addr;
+	}
+	bool operator==(const ScheduleEntity &E) const {
+		return Tid == E.Tid && Flush == E.Flush && Addr == E.Addr;
+	}
+};
+
 #endif
@@ -24,10 +24,6 @@
 using namespace llvm;
 using namespace std;
 
-vector<int> CheckTrace::thread_perm;
-vector<int> CheckTrace::curr_perm;
-vector<pair<pair<int, int>, trace_elem > > CheckTrace::init_perm;
-
 void CheckTrace::gen_init_sc_perm(History* history, int nextThreadNum) {
 	std::map<Thread, int> calls;
 	trace_elem elem;
@@ -394,6 +390,11 @@ void CheckTrace::printPerm() {
 }
 
 int CheckTrace::checkHistory(History* history, int nextThreadNum) {
+	CheckTrace check;
+	return check.checkTrace(history, nextThreadNum);
+}
+
+int CheckTrace::checkTrace(History* history, int nextThreadNum) {
 
 	history->printRecordedTrace();
 
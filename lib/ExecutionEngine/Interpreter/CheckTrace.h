@@ -21,28 +21,32 @@ using namespace std;
 
 namespace llvm {
 
+// CheckTrace - The check of one recorded trace.  The permutations live in
+// the object that checkHistory makes for the trace, so interpreters running
+// on different threads can check their traces at the same time.
 class CheckTrace {
 
 public:
 	int static checkHistory(History*, int);
 private:
-	static vector<int> thread_perm;
-	static vector<int> curr_perm;
-	static vector<pair<pair<int, int>, trace_elem > > init_perm;
-	static void gen_init_sc_perm(History* history, int nextThreadNum);
-  static bool gen_next_sc_perm(int nextThreadNum);
-	static void free_init_sc_perm();
-	static bool sc_check(History*, int);
-	static bool lin_check(History*, int);
-	static bool checkWSQ();
-	static bool checkMalloc();
-	static bool checkQueue();
-	static bool checkDeque();
-	static bool checkLinkSet();
-	static bool checkPermutation();
-	static bool isRealTimeOrderPreserved();
-	static bool check(History*, int, bool);
-	static void printPerm();
+	vector<int> thread_perm;
+	vector<int> curr_perm;
+	vector<pair<pair<int, int>, trace_elem > > init_perm;
+	int checkTrace(History*, int);
+	void gen_init_sc_perm(History* history, int nextThreadNum);
+  bool gen_next_sc_perm(int nextThreadNum);
+	void free_init_sc_perm();
+	bool sc_check(History*, int);
+	bool lin_check(History*, int);
+	bool checkWSQ();
+	bool checkMalloc();
+	bool checkQueue();
+	bool checkDeque();
+	bool checkLinkSet();
+	bool checkPermutation();
+	bool isRealTimeOrderPreserved();
+	bool check(History*, int, bool);
+	void printPerm();
 };
 }
 #endif
@@ -135,8 +135,80 @@ void Constraints::InsertFences(Module* M) {
 }
 
 void Constraints::Calculate(RWHistory* history, int nextThreadNum) {
+	ReorderedPairs pairs;
+	FindReorderings(history, nextThreadNum, pairs);
+	SetClause(pairs);
+}
+
+void Constraints::SetClause(const ReorderedPairs& pairs) {
 	clauses.clear();
+	clausePairs.clear();
+
+	for (ReorderedPairs::const_iterator it = pairs.begin(), ite = pairs.end();
+		it != ite; it++) {
+		int lit;
+		if (it->second) { // store -> load
+			Tso_Constraint_To_Lit::iterator mit = mapToLit.find(it->first);
+			if (mit == mapToLit.end()) {
+				lit = clauseIndex; // clauses?
+				mapToLit.insert(Tso_Constraint_To_Lit_Elem(it->first, lit));
+				clauseIndex = clauseIndex + 1;
+			} else {
+				lit = mit->second;
+			}
+		} else { // store -> store
+			Pso_Constraint_To_Lit::iterator mit = mapToLit_ss.find(it->first);
+			if (mit == mapToLit_ss.end()) {
+				lit = clauseIndex; // clauses?
+				mapToLit_ss.insert(Pso_Constraint_To_Lit_Elem(it->first, lit));
+				clauseIndex = clauseIndex + 1;
+			} else {
+				lit = mit->second;
+			}
+		}
+		if (clauses.insert(lit).second) {
+			clausePairs.push_back(*it);
+		}
+	}
+}
+
+/* record the reorderings of every trace, buggy or not */
+void Constraints::Cover(RWHistory* history, int nextThreadNum) {
+	set<tso_constraint_pair> reordered; // count every pair once per trace
+	Reordered(history, nextThreadNum, reordered);
+	for (set<tso_constraint_pair>::iterator it = reordered.begin(), ite = reordered.end();
+		it != ite; it++) {
+		AddCoverage(*it, 1);
+	}
+}
+
+void Constraints::Reordered(RWHistory* history, int nextThreadNum, set<tso_constraint_pair>& reordered) {
+	ReorderedPairs pairs;
+	FindReorderings(history, nextThreadNum, pairs);
+	for (ReorderedPairs::iterator it = pairs.begin(), ite = pairs.end();
+		it != ite; it++) {
+		reordered.insert(it->first);
+	}
+}
 
+void Constraints::AddCoverage(const tso_constraint_pair& pair, int traces) {
+	int& count = coverage[pair];
+	if (count == 0 && traces > 0) {
+		storeCoverage[pair.first]++;
+	}
+	count += traces;
+}
+
+int Constraints::GetStoreCoverage(int store) {
+	map<int, int>::iterator it = storeCoverage.find(store);
+	return it == storeCoverage.end() ? 0 : it->second;
+}
+
+int Constraints::GetCoverage() {
+	return coverage.size();
+}
+
+void Constraints::FindReorderings(RWHistory* history, int nextThreadNum, ReorderedPairs& pairs) {
 	Trace* trace = &history->shared_rec; // to the accesses which are shared. 
 
 	MapThrdToTrace allTrace;
@@ -159,14 +231,12 @@ void Constraints::Calculate(RWHistory* history, int nextThreadNum) {
 	}
 #endif
 
-	/* for each partial order, generate constraints */
+	/* for each partial order, find the reordered pairs */
 	for (Thread i = 1; i < nextThreadNum; ++i) {
 		Trace* trace_temp = allTrace[i];
 		int size = trace_temp->size();
-		assert(trace_temp->size() > 0); 
-		assert(trace_temp->begin()->label != 0); 
 		int front = 0;
-		while (1) {
+		while (front < size) {
 			if ((*trace_temp)[front].label != 0) {
 				break;
       }
@@ -179,7 +249,7 @@ void Constraints::Calculate(RWHistory* history, int nextThreadNum) {
 		cout << "Back # " << back << endl;
 #endif
 			if (front == back) break;
-			GenerateClauses(front, back, *trace_temp);
+			GenerateClauses(front, back, *trace_temp, pairs);
 			front = findNextBegin(back, *trace_temp);
 			back = findNextEnd(front, *trace_temp);
 		}
@@ -190,7 +260,7 @@ void Constraints::Calculate(RWHistory* history, int nextThreadNum) {
 	}
 }
 
-void Constraints::GenerateClauses(int begin, int end, Trace& trace) {
+void Constraints::GenerateClauses(int begin, int end, Trace& trace, ReorderedPairs& pairs) {
 
 	if (Params::WMM == WMM_TSO) {
 		typedef list<rwtrace_elem> STBuffer;
@@ -200,19 +270,9 @@ void Constraints::GenerateClauses(int begin, int end, Trace& trace) {
 				for (STBuffer::iterator itb = store_buffer.begin(); 
 					itb != store_buffer.end(); itb++) {
 					if (trace[i].location != itb->location) {
-						int lit;
 						int st = itb->label;
 						int ld = trace[i].label;
-						tso_constraint_pair stld_pair = tso_constraint_pair(st, ld);
-						Tso_Constraint_To_Lit::iterator it = mapToLit.find(stld_pair);
-						if (it == mapToLit.end()) {
-							lit = clauseIndex; // clauses?
-							mapToLit.insert(Tso_Constraint_To_Lit_Elem(stld_pair, lit));
-							clauseIndex = clauseIndex + 1;
-						} else {
-							lit = it->second;
-						}
-						clauses.insert(lit);
+						pairs.push_back(ReorderedPair(tso_constraint_pair(st, ld), true));
 					}
 				}
 			} else if (trace[i].type == WRITE) {
@@ -237,19 +297,9 @@ void Constraints::GenerateClauses(int begin, int end, Trace& trace) {
 					for (list<rwtrace_elem>::iterator itl = itb->second.begin();
 						itl != itb->second.end(); itl++) {
 						if (trace[i].location != itl->location) {
-							int lit;
 							int st = itl->label; 
 							int ld = trace[i].label;
-							tso_constraint_pair stld_pair = tso_constraint_pair(st, ld);
-							Tso_Constraint_To_Lit::iterator it = mapToLit.find(stld_pair);
-							if (it == mapToLit.end()) {
-								lit = clauseIndex; // clauses? 
-								mapToLit.insert(Tso_Constraint_To_Lit_Elem(stld_pair, lit));
-								clauseIndex = clauseIndex + 1;
-							} else {
-								lit = it->second;
-							}
-							clauses.insert(lit);
+							pairs.push_back(ReorderedPair(tso_constraint_pair(st, ld), true));
 						}
 					}
 				}
@@ -260,19 +310,9 @@ void Constraints::GenerateClauses(int begin, int end, Trace& trace) {
 					for (list<rwtrace_elem>::iterator itl = itb->second.begin();
 						itl != itb->second.end(); itl++) {
 						if (trace[i].location != itl->location) {
-							int lit;
 							int st1 = itl->label;
 							int st2 = trace[i].label;
-							pso_constraint_pair stst_pair = pso_constraint_pair(st1, st2);
-							Pso_Constraint_To_Lit::iterator it = mapToLit_ss.find(stst_pair);
-							if (it == mapToLit_ss.end()) {
-								lit = clauseIndex; // clauses? 
-								mapToLit_ss.insert(Pso_Constraint_To_Lit_Elem(stst_pair, lit));
-								clauseIndex = clauseIndex + 1;
-							} else {
-								lit = it->second;
-							}
-							clauses.insert(lit);
+							pairs.push_back(ReorderedPair(pso_constraint_pair(st1, st2), false));
 						}
 					}
 				}
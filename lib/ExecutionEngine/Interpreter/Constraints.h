@@ -41,11 +41,15 @@ typedef set<int> ClausesList;
 typedef vector<rwtrace_elem> Trace;
 typedef map<Thread, Trace*> MapThrdToTrace;
 typedef vector<ClausesList*> SatSolutions;
+// a reordered pair of labels, and whether it is store -> load (or store -> store)
+typedef pair<tso_constraint_pair, bool> ReorderedPair;
+typedef vector<ReorderedPair> ReorderedPairs;
 
 class Constraints {
 private:
 	// clauses; need to clean up for each trace
 	ClausesList clauses;
+	ReorderedPairs clausePairs; // the pair of every literal of clauses
 	int clauseIndex;
 
 	// record; in case
@@ -58,6 +62,13 @@ private:
 	SatSolutions satSolutions;
 	ClausesList mergedSatSolution;
 
+	// coverage: the traces each pair has been reordered in, over all rounds,
+	// and the number of pairs reordered per store
+	map<tso_constraint_pair, int> coverage;
+	map<int, int> storeCoverage;
+
+	void FindReorderings(RWHistory* history, int nextThreadNum, ReorderedPairs& pairs);
+
 public:
 	Constraints() {
 		clauseIndex = 1;
@@ -71,7 +82,12 @@ public:
 	void InsertFences(Module* Mod);
 
 	void Calculate(RWHistory* history, int nextThreadNum);
-	void GenerateClauses(int begin, int end, Trace& trace);
+	// the clause of the given reordered pairs, e.g. as a worker of lli-synth -j found them
+	void SetClause(const ReorderedPairs& pairs);
+	const ReorderedPairs& GetClausePairs() { return clausePairs; }
+	void GenerateClauses(int begin, int end, Trace& trace, ReorderedPairs& pairs);
+	void Cover(RWHistory* history, int nextThreadNum);
+	void Reordered(RWHistory* history, int nextThreadNum, set<tso_constraint_pair>& reordered); // what Cover counts
 	void AddToSolver();
 	int Solve();
 	void Merge();
@@ -85,6 +101,10 @@ public:
 	/* for status */
 	int GetLitSingleNumber(); 
 	int GetLitTotalNumber(); 
+	int GetCoverage(); // the pairs reordered so far
+	int GetStoreCoverage(int store); // the pairs reordered so far with the store
+	const map<tso_constraint_pair, int>& GetCoverageMap() { return coverage; }
+	void AddCoverage(const tso_constraint_pair& pair, int traces); // traces more reordered pair
 
 	/* Both functions and their definitions are for drawing figures */
 	int CheckConstraintInst(ClausesList* clist); 
@@ -0,0 +1,347 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ContextBound.h"
+#include "Params.h"
+#include "Scheduler.h"
+#include <algorithm>
+
+using namespace llvm;
+
+// After this many consecutive events a thread yields: running another thread
+// or flushing a delayed buffer is then no preemption.
+static const unsigned MaxRunLength = 64;
+
+static BoundedExplorer TheExplorer;
+
+BoundedExplorer &BoundedExplorer::get() {
+	return TheExplorer;
+}
+
+BoundedExplorer::BoundedExplorer() {
+	restart();
+	beginTrace();
+}
+
+void BoundedExplorer::restart() {
+	Stack.clear();
+	Bound = 0;
+	Paths.clear();
+	Work.clear();
+	Later.clear();
+	Replay.clear();
+	Resuming = false;
+	Complete = false;
+	Traces = 0;
+	Start = time(0);
+	WarnedDivergence = false;
+}
+
+void BoundedExplorer::beginTrace() {
+	// a run after the exploration completed starts it over
+	if (Complete)
+		restart();
+	Depth = 0;
+	Interp = 0;
+	InEvent = false;
+	LastThread = 1;
+	RunLength = 0;
+	Preemptions = 0;
+	DelayedFlushes = 0;
+	Blocked.clear();
+	Delayed.clear();
+	CSCounter = 0;
+	PreemptiveCSCounter = 0;
+}
+
+void BoundedExplorer::endTrace() {
+	if (InEvent)
+		closeEvent();
+	if (Resuming)
+		warnDivergence();
+	Resuming = false;
+	++Traces;
+	prepareNextTrace();
+	if (!Complete && Params::boundTime > 0 &&
+			difftime(time(0), Start) >= Params::boundTime) {
+		Complete = true;
+		cout << "BOUNDED: time budget exhausted at bound " << Bound << " after "
+			<< Traces << " traces" << endl;
+	}
+}
+
+bool BoundedExplorer::withinBound(const State &S, unsigned k) const {
+	return S.Preemptions + S.Preempts[k] <= Bound &&
+		S.DelayedFlushes + S.Delays[k] <= Bound;
+}
+
+// pathTo - The path to the decision at Depth, made of the paths already made
+// for the decisions before it.
+int BoundedExplorer::pathTo(unsigned Depth) {
+	unsigned j = Depth;
+	while (j > 0 && Stack[j - 1].Path < 0)
+		--j;
+	int Node = j > 0 ? Stack[j - 1].Path : -1;
+	for (; j < Depth; ++j) {
+		Stack[j].Path = Paths.size();
+		Paths.push_back(PathNode(Node, Stack[j].Choice));
+		Node = Stack[j].Path;
+	}
+	return Node;
+}
+
+// defer - Set the decision at Depth aside for a larger bound.  Its untried
+// choices are beyond the bound; the tried ones are done for good.
+void BoundedExplorer::defer(unsigned Depth) {
+	Later.push_back(Deferred());
+	Later.back().Path = pathTo(Depth);
+	Later.back().S = Stack[Depth];
+}
+
+// resume - Make the next run go down the path of a decision set aside and take
+// one of its choices that the bound now allows.  Decisions with none are set
+// aside again.
+bool BoundedExplorer::resume() {
+	while (!Work.empty()) {
+		Deferred &D = Work.back();
+		for (unsigned k = 0; k < D.S.Enabled.size(); ++k) {
+			if (D.S.Done[k] || !withinBound(D.S, k))
+				continue;
+			Resumed = D.S;
+			Resumed.Done[k] = 1;
+			Resumed.Choice = k;
+			Resumed.Path = -1;
+			Replay.clear();
+			for (int N = D.Path; N >= 0; N = Paths[N].Parent)
+				Replay.push_back(Paths[N].Choice);
+			std::reverse(Replay.begin(), Replay.end());
+			Resuming = true;
+			Work.pop_back();
+			return true;
+		}
+		Later.push_back(D);
+		Work.pop_back();
+	}
+	return false;
+}
+
+// prepareNextTrace - Find the deepest state with an alternative left within
+// the bound and make it the decision the next run takes there, setting aside
+// the states whose other alternatives are beyond it.  Once there is none,
+// resume the decisions set aside, raising the bound when they need it.
+void BoundedExplorer::prepareNextTrace() {
+	for (;;) {
+		while (!Stack.empty()) {
+			State &S = Stack.back();
+			bool Beyond = false;
+			for (unsigned k = 0; k < S.Enabled.size(); ++k) {
+				if (S.Done[k])
+					continue;
+				if (withinBound(S, k)) {
+					S.Done[k] = 1;
+					S.Choice = k;
+					S.Path = -1;
+					return;
+				}
+				Beyond = true;
+			}
+			if (Beyond)
+				defer(Stack.size() - 1);
+			Stack.pop_back();
+		}
+		if (resume())
+			return;
+		if (Later.empty() || Bound >= Params::maxBound)
+			break;
+		cout << "BOUNDED: bound " << Bound << " exhausted after " << Traces
+			<< " traces" << endl;
+		++Bound;
+		Work.swap(Later);
+	}
+	Complete = true;
+	cout << "BOUNDED: bound " << Bound << " exhausted after " << Traces
+		<< " traces (exploration complete)" << endl;
+}
+
+// sameEntities - Whether a decision sees the threads and buffers it saw in an
+// earlier run.
+static bool sameEntities(const std::vector<ScheduleEntity> &A,
+		const std::vector<ScheduleEntity> &B) {
+	if (A.size() != B.size())
+		return false;
+	for (unsigned k = 0; k < A.size(); ++k)
+		if (A[k].Tid != B[k].Tid || A[k].Flush != B[k].Flush)
+			return false;
+	return true;
+}
+
+void BoundedExplorer::warnDivergence() {
+	if (!WarnedDivergence)
+		cout << "BOUNDED: the program did not replay its schedule; "
+			"exploring from the point it diverged" << endl;
+	WarnedDivergence = true;
+}
+
+// isDecisionPoint - Whether the event of the current thread is over, as for
+// DPORExplorer.
+bool BoundedExplorer::isDecisionPoint() const {
+	const Interpreter::last_instr_info &info = Interp->instr_info;
+	if (info.isSharedAccessing || info.isBlocked || info.isSynchronizing ||
+			info.isAtomic)
+		return true;
+	const vector<Thread> &threads = Interp->getAllActiveThreads();
+	return !std::binary_search(threads.begin(), threads.end(),
+			Interp->getCurrThread());
+}
+
+void BoundedExplorer::closeEvent() {
+	InEvent = false;
+	if (Cur.Flush)
+		return;
+	if (Blocked.size() <= (unsigned)Cur.Tid)
+		Blocked.resize(Cur.Tid + 1, 0);
+	Blocked[Cur.Tid] = Interp->instr_info.isBlocked;
+}
+
+// makeState - The costs of the choices of a new decision, and the choice that
+// costs nothing: the next eager flush, else the current thread, else the next
+// thread round robin.
+void BoundedExplorer::makeState(State &S, const std::vector<Entity> &Enabled) {
+	unsigned n = Enabled.size();
+	S.Enabled = Enabled;
+	S.Preempts.assign(n, 0);
+	S.Delays.assign(n, 0);
+	S.Done.assign(n, 0);
+	S.Preemptions = Preemptions;
+	S.DelayedFlushes = DelayedFlushes;
+	S.Path = -1;
+
+	bool currRuns = false;
+	unsigned eager = 0;
+	for (unsigned k = 0; k < n; ++k) {
+		if (!Enabled[k].Flush && Enabled[k].Tid == LastThread)
+			currRuns = true;
+		if (Enabled[k].Flush && !Delayed.count(Enabled[k]))
+			++eager;
+	}
+	bool preempts = currRuns && RunLength < MaxRunLength;
+
+	int choice = -1;
+	for (unsigned k = 0; k < n; ++k) {
+		const Entity &E = Enabled[k];
+		if (E.Flush && !Delayed.count(E)) {
+			if (choice < 0 ||
+					(E.Tid == LastThread && Enabled[choice].Tid != LastThread))
+				choice = k;
+			continue;
+		}
+		if (!E.Flush)
+			S.Delays[k] = eager;
+		if (preempts && !(E.Tid == LastThread && !E.Flush))
+			S.Preempts[k] = 1;
+	}
+	if (choice < 0 && preempts) {
+		for (unsigned k = 0; k < n && choice < 0; ++k)
+			if (!Enabled[k].Flush && Enabled[k].Tid == LastThread)
+				choice = k;
+	}
+	for (unsigned k = 0; k < n && choice < 0; ++k)
+		if (!Enabled[k].Flush && Enabled[k].Tid > LastThread)
+			choice = k;
+	for (unsigned k = 0; k < n && choice < 0; ++k)
+		if (!Enabled[k].Flush)
+			choice = k;
+	S.Choice = choice < 0 ? 0 : choice;
+	S.Done[S.Choice] = 1;
+}
+
+Action BoundedExplorer::selectAction(const Interpreter *I, unsigned &psoIndex) {
+	Interp = I;
+	if (InEvent) {
+		if (!Cur.Flush && !isDecisionPoint()) {
+			Action action;
+			action.type = SWITCH_THREAD;
+			action.thread = Thread(Cur.Tid);
+			return action;
+		}
+		closeEvent();
+	} else if (Depth == 0) {
+		LastThread = I->getCurrThread().tid();
+	}
+
+	std::vector<Entity> Enabled;
+	Scheduler::collectEntities(I, Blocked, Enabled);
+
+	// a buffer that a fence drained takes new stores eagerly again
+	for (std::set<Entity>::iterator It = Delayed.begin(); It != Delayed.end(); ) {
+		if (std::find(Enabled.begin(), Enabled.end(), *It) == Enabled.end())
+			Delayed.erase(It++);
+		else
+			++It;
+	}
+
+	if (Depth < Stack.size()) {
+		// replay the decision of the previous run
+		State &S = Stack[Depth];
+		if (sameEntities(S.Enabled, Enabled)) {
+			// the addresses may have changed since
+			S.Enabled = Enabled;
+		} else {
+			warnDivergence();
+			Stack.resize(Depth);
+		}
+	}
+	if (Depth == Stack.size()) {
+		Stack.push_back(State());
+		State &S = Stack.back();
+		makeState(S, Enabled);
+		if (Resuming) {
+			if (Depth < Replay.size() && Replay[Depth] < Enabled.size()) {
+				// on the way to the decision resumed: its alternatives are set
+				// aside on their own or were run within a smaller bound
+				S.Choice = Replay[Depth];
+				S.Done.assign(Enabled.size(), 1);
+			} else if (Depth == Replay.size() &&
+					sameEntities(Resumed.Enabled, Enabled)) {
+				S = Resumed;
+				S.Enabled = Enabled;
+				Resuming = false;
+			} else {
+				warnDivergence();
+				Resuming = false;
+			}
+		}
+	}
+	const State &S = Stack[Depth];
+	++Depth;
+
+	unsigned Choice = S.Choice;
+	Preemptions += S.Preempts[Choice];
+	DelayedFlushes += S.Delays[Choice];
+	Cur = Enabled[Choice];
+	InEvent = true;
+
+	if (!Cur.Flush) {
+		if (S.Delays[Choice])
+			for (unsigned k = 0; k < Enabled.size(); ++k)
+				if (Enabled[k].Flush)
+					Delayed.insert(Enabled[k]);
+		if (Cur.Tid != LastThread) {
+			++CSCounter;
+			if (S.Preempts[Choice])
+				++PreemptiveCSCounter;
+		}
+		RunLength = Cur.Tid == LastThread ? RunLength + 1 : 1;
+		LastThread = Cur.Tid;
+	}
+	return Scheduler::entityAction(I, Cur, psoIndex);
+}
@@ -0,0 +1,140 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLI_CONTEXTBOUND_H
+#define LLI_CONTEXTBOUND_H
+
+#include "Interpreter.h"
+#include "Action.h"
+
+#include <ctime>
+#include <set>
+#include <vector>
+
+namespace llvm {
+
+	// BoundedExplorer - Iterative context bounding (the scheduler
+	// SCHEDULER = BOUNDED): every schedule with at most k preemptions and at
+	// most k delayed flushes is run, for k = 0, 1, ... up to BOUND.
+	//
+	// As for DPORExplorer, a schedule is a sequence of events of threads and
+	// store buffers.  The schedule that costs nothing runs the current thread
+	// until it blocks or finishes and flushes every store right after it.
+	// Running another thread while the current one could go on is a
+	// preemption; running a thread instead of flushing a store delays the
+	// buffer, which then keeps its stores until a fence drains it or a later
+	// decision flushes it (which again preempts the current thread).  A thread
+	// that ran MaxRunLength events in a row yields, so spin loops do not need
+	// a preemption to let the other threads go.
+	//
+	// The decisions of the current schedule are kept across runs, and every
+	// run takes the next untried alternative within the bound.  As in CHESS,
+	// a decision with choices beyond the bound is set aside with the path to
+	// it, and bound k+1 only resumes these decisions, so no schedule within
+	// bound k runs again.  lli-synth
+	// stops a round at the first violation, when the bound is exhausted, or
+	// when BOUNDTIME seconds have passed.
+	//
+	class BoundedExplorer {
+		typedef ScheduleEntity Entity;
+
+		// State - A decision of the schedule: what could run, what each choice
+		// costs, and which choices have been tried.
+		struct State {
+			std::vector<Entity> Enabled;
+			std::vector<unsigned char> Preempts;  // preemptions a choice costs
+			std::vector<unsigned char> Delays;    // delayed flushes a choice costs
+			std::vector<char> Done;
+			unsigned Choice;
+			unsigned Preemptions;   // spent before the decision
+			unsigned DelayedFlushes;
+			int Path;               // the path through Choice, -1 if not made yet
+		};
+
+		// PathNode - A choice and the path before it.  The paths to the
+		// decisions set aside share their prefixes.
+		struct PathNode {
+			int Parent;
+			unsigned Choice;
+			PathNode(int P, unsigned C) : Parent(P), Choice(C) {}
+		};
+
+		// Deferred - A decision with choices beyond the bound, and the path to
+		// it.
+		struct Deferred {
+			int Path;
+			State S;
+		};
+
+		// exploration, kept across runs
+		std::vector<State> Stack;
+		unsigned Bound;
+		std::vector<PathNode> Paths;
+		std::vector<Deferred> Work;    // decisions to resume within Bound
+		std::vector<Deferred> Later;   // decisions set aside for a larger bound
+		std::vector<unsigned> Replay;  // the path to the decision resumed
+		State Resumed;
+		bool Resuming;
+		bool Complete;
+		unsigned Traces;
+		time_t Start;
+		bool WarnedDivergence;
+
+		// the current run
+		unsigned Depth;
+		const Interpreter *Interp;
+		bool InEvent;
+		Entity Cur;
+		int LastThread;
+		unsigned RunLength;
+		unsigned Preemptions;
+		unsigned DelayedFlushes;
+		std::vector<char> Blocked;     // the last event of the thread blocked
+		std::set<Entity> Delayed;      // buffers that keep their stores
+
+		bool isDecisionPoint() const;
+		void closeEvent();
+		void warnDivergence();
+		void makeState(State &S, const std::vector<Entity> &Enabled);
+		bool withinBound(const State &S, unsigned k) const;
+		int pathTo(unsigned Depth);
+		void defer(unsigned Depth);
+		bool resume();
+		void prepareNextTrace();
+
+		public:
+		BoundedExplorer();
+
+		// get - The explorer of the process.
+		static BoundedExplorer &get();
+
+		// beginTrace/endTrace - Bracket one run of the program.
+		void beginTrace();
+		void endTrace();
+
+		// selectAction - The next action of the run, as
+		// DPORExplorer::selectAction.
+		Action selectAction(const Interpreter *I, unsigned &psoIndex);
+
+		// isComplete - Whether every schedule within BOUND has been run, or
+		// BOUNDTIME has passed.
+		bool isComplete() const { return Complete; }
+		// restart - Start over from bound 0, e.g. after the program changed.
+		void restart();
+
+		unsigned getBound() const { return Bound; }
+		unsigned getNumTraces() const { return Traces; }
+	};
+
+}
+
+#endif
@@ -0,0 +1,508 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "DPOR.h"
+#include "Params.h"
+#include "Scheduler.h"
+#include "llvm/Support/CommandLine.h"
+#include <algorithm>
+
+using namespace llvm;
+
+static cl::opt<unsigned> DPORDepth("dpor-depth",
+		cl::desc("Number of decisions of a trace for which the DPOR scheduler "
+			"explores alternatives; later ones are taken by default"),
+		cl::value_desc("n"), cl::init(10000));
+
+// After this many consecutive events of one thread the default decision moves
+// on to the next thread, so that a thread spinning on a flag lets the others
+// set it.
+static const unsigned MaxRunLength = 64;
+
+// The depth of the events taken beyond -dpor-depth, which get no state.
+static const unsigned NoDepth = ~0U;
+// The parent of the first thread.
+static const unsigned NoEntity = ~0U;
+
+static uint64_t mix(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+// eventName - The name of the n-th event of thread tid, the same in every
+// trace; the flush of a store is named after the store.
+static uint64_t eventName(int tid, unsigned n) {
+	return mix(((uint64_t)(unsigned)tid << 32) | n);
+}
+
+static uint64_t flushName(uint64_t storeName) {
+	return mix(storeName ^ 0xF1F1F1F1F1F1F1F1ULL);
+}
+
+typedef std::vector<unsigned> Clock;
+
+static void join(Clock &C, const Clock &D) {
+	if (C.size() < D.size())
+		C.resize(D.size(), 0);
+	for (unsigned i = 0; i < D.size(); ++i)
+		if (C[i] < D[i])
+			C[i] = D[i];
+}
+
+template<class T>
+static void growTo(std::vector<T> &V, unsigned n) {
+	if (V.size() < n)
+		V.resize(n, T());
+}
+
+static DPORExplorer TheExplorer;
+
+DPORExplorer &DPORExplorer::get() {
+	return TheExplorer;
+}
+
+DPORExplorer::DPORExplorer() {
+	restart();
+	beginTrace();
+}
+
+void DPORExplorer::restart() {
+	Stack.clear();
+	Complete = false;
+	Traces = 0;
+	Classes.clear();
+	WarnedDivergence = false;
+}
+
+void DPORExplorer::beginTrace() {
+	// a run after the exploration completed starts it over
+	if (Complete)
+		restart();
+	Depth = 0;
+	EntityIds.clear();
+	Entities.clear();
+	Clocks.clear();
+	ThreadEvents.clear();
+	Blocked.clear();
+	Accesses.clear();
+	HasGlobal = false;
+	Pending.clear();
+	Signature = 0;
+	Interp = 0;
+	InEvent = false;
+	CurEnt = 0;
+	CurDepth = NoDepth;
+	RunLength = 0;
+}
+
+void DPORExplorer::endTrace() {
+	if (InEvent)
+		closeEvent();
+	++Traces;
+	Classes.insert(Signature);
+	prepareNextTrace();
+	cout << "DPOR: " << Traces << " traces explored, " << Classes.size()
+		<< " equivalence classes" << (Complete ? " (exploration complete)" : "")
+		<< endl;
+}
+
+// prepareNextTrace - Find the deepest state with an alternative left and make
+// it the decision the next trace takes there.
+void DPORExplorer::prepareNextTrace() {
+	while (!Stack.empty()) {
+		State &S = Stack.back();
+		for (unsigned k = 0; k < S.Enabled.size(); ++k) {
+			if (S.Backtrack[k] && !S.Done[k]) {
+				S.Done[k] = 1;
+				S.Choice = k;
+				return;
+			}
+		}
+		Stack.pop_back();
+	}
+	Complete = true;
+}
+
+unsigned DPORExplorer::getEntityId(const Entity &E) {
+	std::pair<std::map<Entity, unsigned>::iterator, bool> Ins =
+		EntityIds.insert(std::make_pair(E, (unsigned)Entities.size()));
+	if (Ins.second) {
+		Entities.push_back(E);
+		Clocks.push_back(Clock());
+	}
+	return Ins.first->second;
+}
+
+// collectEnabled - What can run now; the order only depends on what happened
+// so far, so a replayed decision finds the same entity at the same index.
+void DPORExplorer::collectEnabled(std::vector<Entity> &Enabled) {
+	Scheduler::collectEntities(Interp, Blocked, Enabled);
+}
+
+// entityName - What tells E apart from the other entities in every trace that
+// replays the same decisions: a thread its id, a buffer the store it flushes
+// next.  The addresses of the buffers may change from trace to trace.
+uint64_t DPORExplorer::entityName(const Entity &E) const {
+	if (!E.Flush)
+		return 0;
+	std::map<Entity, std::deque<PendingStore> >::const_iterator It =
+		Pending.find(E);
+	if (It == Pending.end() || It->second.empty())
+		return 0;
+	return It->second.front().Name;
+}
+
+// matchState - Whether what can run now is what could run at S in the
+// previous trace.  If so, Enabled and Names are put into the order of S, so
+// that its choices keep their index.
+bool DPORExplorer::matchState(const State &S, std::vector<Entity> &Enabled,
+		std::vector<uint64_t> &Names) const {
+	unsigned n = Enabled.size();
+	if (S.Enabled.size() != n)
+		return false;
+	std::vector<Entity> OrderedEnabled(n);
+	std::vector<uint64_t> OrderedNames(n);
+	std::vector<char> Used(n, 0);
+	for (unsigned k = 0; k < n; ++k) {
+		const Entity &E = S.Enabled[k];
+		unsigned j = 0;
+		while (j < n && (Used[j] || Enabled[j].Tid != E.Tid ||
+					Enabled[j].Flush != E.Flush || Names[j] != S.Names[k]))
+			++j;
+		if (j == n)
+			return false;
+		Used[j] = 1;
+		OrderedEnabled[k] = Enabled[j];
+		OrderedNames[k] = Names[j];
+	}
+	Enabled.swap(OrderedEnabled);
+	Names.swap(OrderedNames);
+	return true;
+}
+
+// defaultChoice - The decision of a new state.  Stores are flushed at once,
+// the current thread's first; the races of the flushes then tell which of
+// them to delay.  Otherwise the current thread keeps running for a while.
+unsigned DPORExplorer::defaultChoice(const std::vector<Entity> &Enabled) {
+	int curr = Interp->getCurrThread().tid();
+	int firstFlush = -1;
+	for (unsigned k = 0; k < Enabled.size(); ++k) {
+		if (!Enabled[k].Flush)
+			continue;
+		if (Enabled[k].Tid == curr)
+			return k;
+		if (firstFlush < 0)
+			firstFlush = k;
+	}
+	if (firstFlush >= 0)
+		return firstFlush;
+	if (RunLength < MaxRunLength)
+		for (unsigned k = 0; k < Enabled.size(); ++k)
+			if (!Enabled[k].Flush && Enabled[k].Tid == curr)
+				return k;
+	// round robin from the current thread
+	for (unsigned k = 0; k < Enabled.size(); ++k)
+		if (!Enabled[k].Flush && Enabled[k].Tid > curr)
+			return k;
+	for (unsigned k = 0; k < Enabled.size(); ++k)
+		if (!Enabled[k].Flush)
+			return k;
+	return 0;
+}
+
+// isDecisionPoint - Whether the event of the current thread is over: it made
+// a shared access, blocked, synchronized or finished.
+bool DPORExplorer::isDecisionPoint() const {
+	const Interpreter::last_instr_info &info = Interp->instr_info;
+	if (info.isSharedAccessing || info.isBlocked || info.isSynchronizing ||
+			info.isAtomic)
+		return true;
+	const vector<Thread> &threads = Interp->getAllActiveThreads();
+	return !std::binary_search(threads.begin(), threads.end(),
+			Interp->getCurrThread());
+}
+
+Action DPORExplorer::selectAction(const Interpreter *I, unsigned &psoIndex) {
+	Interp = I;
+	if (InEvent) {
+		const Entity &E = Entities[CurEnt];
+		if (!E.Flush && !isDecisionPoint()) {
+			Action action;
+			action.type = SWITCH_THREAD;
+			action.thread = Thread(E.Tid);
+			return action;
+		}
+		closeEvent();
+	} else if (Entities.empty()) {
+		noteThreads(NoEntity);
+	}
+
+	std::vector<Entity> Enabled;
+	collectEnabled(Enabled);
+	std::vector<uint64_t> Names(Enabled.size());
+	for (unsigned k = 0; k < Enabled.size(); ++k)
+		Names[k] = entityName(Enabled[k]);
+
+	unsigned Choice = 0;
+	bool Fresh = true;
+	if (Depth < Stack.size()) {
+		// replay the decision of the previous trace
+		State &S = Stack[Depth];
+		if (matchState(S, Enabled, Names)) {
+			// the addresses may have changed since
+			S.Enabled = Enabled;
+			Choice = S.Choice;
+			Fresh = false;
+		} else {
+			if (!WarnedDivergence)
+				cout << "DPOR: the program did not replay its schedule; "
+					"exploring from the point it diverged" << endl;
+			WarnedDivergence = true;
+			Stack.resize(Depth);
+		}
+	}
+	if (Fresh) {
+		Choice = defaultChoice(Enabled);
+		if (Depth < DPORDepth) {
+			Stack.push_back(State());
+			State &S = Stack.back();
+			S.Enabled = Enabled;
+			S.Names = Names;
+			S.Backtrack.assign(Enabled.size(), 0);
+			S.Done.assign(Enabled.size(), 0);
+			S.Done[Choice] = 1;
+			S.Choice = Choice;
+		}
+	}
+	CurDepth = Depth < Stack.size() ? Depth : NoDepth;
+	++Depth;
+
+	const Entity E = Enabled[Choice];
+	CurEnt = getEntityId(E);
+	InEvent = true;
+
+	if (!E.Flush)
+		RunLength = E.Tid == I->getCurrThread().tid() ? RunLength + 1 : 1;
+	return Scheduler::entityAction(I, E, psoIndex);
+}
+
+// noteThreads - Give the threads that just started a clock: what their parent
+// did before spawning them happens before all they do.
+void DPORExplorer::noteThreads(unsigned Parent) {
+	const vector<Thread> &threads = Interp->getAllActiveThreads();
+	for (unsigned i = 0; i < threads.size(); ++i) {
+		Entity E(threads[i].tid());
+		if (EntityIds.count(E))
+			continue;
+		unsigned Id = getEntityId(E);
+		if (Parent != NoEntity)
+			Clocks[Id] = Clocks[Parent];
+	}
+}
+
+void DPORExplorer::closeEvent() {
+	InEvent = false;
+	const Entity E = Entities[CurEnt];
+	std::vector<std::pair<void*, bool> > Footprint;
+
+	if (E.Flush) {
+		std::deque<PendingStore> &Q = Pending[E];
+		if (Q.empty()) {
+			// a store the explorer did not see; order it with everything
+			recordEvent(Footprint, true, flushName(0), 0);
+			return;
+		}
+		PendingStore S = Q.front();
+		Q.pop_front();
+		Footprint.push_back(std::make_pair(S.Addr, true));
+		recordEvent(Footprint, false, flushName(S.Name), &S.C);
+		return;
+	}
+
+	const Interpreter::last_instr_info &info = Interp->instr_info;
+	int tid = E.Tid;
+	growTo(Blocked, tid + 1);
+	growTo(ThreadEvents, tid + 1);
+	if (info.isBlocked) {
+		// a join_all that has to wait changes nothing
+		Blocked[tid] = 1;
+		return;
+	}
+
+	Clock Joined;
+	const Clock *Extra = 0;
+	if (Blocked[tid]) {
+		// the thread got through join_all: the other threads are done
+		Blocked[tid] = 0;
+		for (unsigned k = 0; k < Entities.size(); ++k)
+			if (!Entities[k].Flush && Entities[k].Tid != tid)
+				join(Joined, Clocks[k]);
+		Extra = &Joined;
+	}
+
+	// the stores a fence or an atomic drained are written by this event
+	if (Params::WMM == WMM_TSO) {
+		std::map<Entity, std::deque<PendingStore> >::iterator It =
+			Pending.find(Entity(tid, true));
+		if (It != Pending.end()) {
+			const TSOBuffer *buffer = Interp->thread_buffer_tso.find(Thread(tid));
+			unsigned Left = buffer ? buffer->size() : 0;
+			for (; It->second.size() > Left; It->second.pop_front())
+				Footprint.push_back(std::make_pair(It->second.front().Addr, true));
+		}
+	} else if (Params::WMM == WMM_PSO) {
+		const PSOBuffer *buffer = Interp->thread_buffer_pso.find(Thread(tid));
+		std::map<Entity, std::deque<PendingStore> >::iterator It =
+			Pending.lower_bound(Entity(tid, true));
+		for (; It != Pending.end() && It->first.Tid == tid; ++It) {
+			unsigned Left = buffer ? buffer->size(It->first.Addr) : 0;
+			for (; It->second.size() > Left; It->second.pop_front())
+				Footprint.push_back(std::make_pair(It->first.Addr, true));
+		}
+	}
+
+	// a store under TSO or PSO only reaches the buffer; its flush is the write
+	void *Addr = (void*)info.addr;
+	bool Buffered = info.isSharedAccessing && !info.isWriteOrRead &&
+		Params::WMM != WMM_NONE;
+	if (info.isSharedAccessing && !Buffered)
+		Footprint.push_back(std::make_pair(Addr, !info.isWriteOrRead));
+
+	uint64_t Name = eventName(tid, ++ThreadEvents[tid]);
+	recordEvent(Footprint, info.isAtomic, Name, Extra);
+
+	if (Buffered) {
+		Entity F(tid, true, Params::WMM == WMM_PSO ? Addr : 0);
+		PendingStore S;
+		S.Addr = Addr;
+		S.Name = Name;
+		S.C = Clocks[CurEnt];
+		Pending[F].push_back(S);
+	}
+	noteThreads(CurEnt);
+}
+
+// recordEvent - Advance the clock of the current entity past the event, find
+// the earlier events it depends on and backtrack for the ones that race with
+// it, then remember it for the later events.
+void DPORExplorer::recordEvent(
+		const std::vector<std::pair<void*, bool> > &Footprint,
+		bool Global, uint64_t Name, const Clock *Extra) {
+	Clock &C = Clocks[CurEnt];
+	growTo(C, CurEnt + 1);
+	++C[CurEnt];
+	if (Extra)
+		join(C, *Extra);
+	Signature += mix(Name);
+
+	std::vector<const Access*> Deps;
+	for (unsigned i = 0; i < Footprint.size(); ++i) {
+		DenseMap<void*, AddressInfo>::iterator It = Accesses.find(Footprint[i].first);
+		if (It == Accesses.end())
+			continue;
+		const AddressInfo &A = It->second;
+		bool IsWrite = Footprint[i].second;
+		if (IsWrite)
+			for (unsigned r = 0; r < A.Reads.size(); ++r)
+				Deps.push_back(&A.Reads[r]);
+		if (A.HasWrite && (!IsWrite || A.Reads.empty()))
+			Deps.push_back(&A.Write);
+	}
+	if (Global) {
+		for (DenseMap<void*, AddressInfo>::iterator It = Accesses.begin(),
+				E = Accesses.end(); It != E; ++It) {
+			const AddressInfo &A = It->second;
+			for (unsigned r = 0; r < A.Reads.size(); ++r)
+				Deps.push_back(&A.Reads[r]);
+			if (A.HasWrite)
+				Deps.push_back(&A.Write);
+		}
+	}
+	if (HasGlobal && (Global || !Footprint.empty()))
+		Deps.push_back(&LastGlobal);
+
+	// A dependent event that does not happen before this one is a race.  A
+	// thread and its own buffers do not race: a load sees the thread's last
+	// store whether it was flushed or not, and a fence flushes what is left.
+	Clock Before = C;
+	int tid = Entities[CurEnt].Tid;
+	for (unsigned i = 0; i < Deps.size(); ++i) {
+		const Access &D = *Deps[i];
+		join(C, D.C);
+		if (Entities[D.Ent].Tid == tid)
+			continue;
+		Signature += mix(D.Name ^ mix(Name + 1));
+		bool Ordered = D.Ent < Before.size() && Before[D.Ent] >= D.Time;
+		if (!Ordered && D.Depth != NoDepth)
+			addBacktrack(D.Depth, Entities[CurEnt]);
+	}
+
+	Access Self;
+	Self.Ent = CurEnt;
+	Self.Time = C[CurEnt];
+	Self.Depth = CurDepth;
+	Self.Name = Name;
+	Self.C = C;
+	if (Global) {
+		// everything so far happens before it, so it stands in for all of it
+		Accesses.clear();
+		HasGlobal = true;
+		LastGlobal = Self;
+	}
+	for (unsigned i = 0; i < Footprint.size(); ++i) {
+		AddressInfo &A = Accesses[Footprint[i].first];
+		if (Footprint[i].second) {
+			A.HasWrite = true;
+			A.Write = Self;
+			A.Reads.clear();
+		} else {
+			unsigned r = 0;
+			while (r < A.Reads.size() && A.Reads[r].Ent != CurEnt)
+				++r;
+			if (r == A.Reads.size())
+				A.Reads.push_back(Self);
+			else
+				A.Reads[r] = Self;
+		}
+	}
+}
+
+// addBacktrack - E has to be tried at the given state.  If it could not run
+// there, something that leads to it is tried instead: for a flush the thread
+// that makes the store, for a thread in join_all or not spawned yet the
+// threads.  Failing that, everything that could run has to be tried.
+void DPORExplorer::addBacktrack(unsigned StateDepth, const Entity &E) {
+	if (StateDepth >= Stack.size())
+		return;
+	State &S = Stack[StateDepth];
+	for (unsigned k = 0; k < S.Enabled.size(); ++k) {
+		if (S.Enabled[k] == E) {
+			S.Backtrack[k] = 1;
+			return;
+		}
+	}
+	bool Added = false;
+	for (unsigned k = 0; k < S.Enabled.size(); ++k) {
+		const Entity &F = S.Enabled[k];
+		if (E.Flush ? F == Entity(E.Tid) : !F.Flush) {
+			S.Backtrack[k] = 1;
+			Added = true;
+		}
+	}
+	if (!Added)
+		for (unsigned k = 0; k < S.Enabled.size(); ++k)
+			S.Backtrack[k] = 1;
+}
@@ -0,0 +1,160 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLI_DPOR_H
+#define LLI_DPOR_H
+
+#include "Interpreter.h"
+#include "Action.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/System/DataTypes.h"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace llvm {
+
+	// DPORExplorer - Systematic exploration of the schedules of a program by
+	// dynamic partial-order reduction (the scheduler SCHEDULER = DPOR).
+	//
+	// Every trace is a sequence of events, and every event is run by an entity:
+	// a thread, which runs until and including its next shared access, or a
+	// store buffer, which flushes its oldest store (under TSO a thread has one
+	// buffer, under PSO one per address).  Two events are dependent if they are
+	// run by the same entity or touch the same address and one of them writes;
+	// fences, atomics and the stores they drain count as writes.
+	//
+	// The explorer keeps the stack of the decisions of the current trace across
+	// runs of the interpreter, so it lives as long as the process.  Every run
+	// replays the decisions down to the last state that still has an untried
+	// alternative, takes it, and then makes default decisions.  Vector clocks
+	// tell which dependent events are not ordered by happens-before; for such a
+	// race the entity of the later event is added to the backtrack set of the
+	// state the earlier one was taken from, so only the reorderings that change
+	// the outcome are explored.
+	//
+	// Each trace is also summarized by a hash of its events and the dependences
+	// between them, which is the same for all traces of a Mazurkiewicz
+	// equivalence class; the number of distinct summaries is reported next to
+	// the number of traces.
+	//
+	class DPORExplorer {
+		public:
+		typedef ScheduleEntity Entity;
+
+		private:
+		typedef std::vector<unsigned> Clock;
+
+		// State - A decision of the trace: what could run, what did, and what
+		// still has to be tried.
+		struct State {
+			std::vector<Entity> Enabled;
+			std::vector<uint64_t> Names;   // entityName of each of Enabled
+			std::vector<char> Backtrack;
+			std::vector<char> Done;
+			unsigned Choice;
+		};
+
+		// Access - An event as later events see it: who ran it, at which time of
+		// its entity, from which state, and with which clock.
+		struct Access {
+			unsigned Ent;
+			unsigned Time;
+			unsigned Depth;
+			uint64_t Name;
+			Clock C;
+		};
+
+		struct AddressInfo {
+			bool HasWrite;
+			Access Write;               // the last write
+			std::vector<Access> Reads;  // the reads since, one per entity
+			AddressInfo() : HasWrite(false) {}
+		};
+
+		// PendingStore - A buffered store, waiting for its flush.
+		struct PendingStore {
+			void *Addr;
+			uint64_t Name;
+			Clock C;
+		};
+
+		// exploration, kept across traces
+		std::vector<State> Stack;
+		bool Complete;
+		unsigned Traces;
+		std::set<uint64_t> Classes;
+		bool WarnedDivergence;
+
+		// the current trace
+		unsigned Depth;                    // decisions taken so far
+		std::map<Entity, unsigned> EntityIds;
+		std::vector<Entity> Entities;
+		std::vector<Clock> Clocks;
+		std::vector<unsigned> ThreadEvents;  // events per thread, for names
+		std::vector<char> Blocked;           // the last event of the thread blocked
+		DenseMap<void*, AddressInfo> Accesses;
+		bool HasGlobal;
+		Access LastGlobal;
+		std::map<Entity, std::deque<PendingStore> > Pending;
+		uint64_t Signature;
+
+		// the event being run
+		const Interpreter *Interp;
+		bool InEvent;
+		unsigned CurEnt;
+		unsigned CurDepth;
+		unsigned RunLength;      // consecutive events of the current thread
+
+		unsigned getEntityId(const Entity &E);
+		void collectEnabled(std::vector<Entity> &Enabled);
+		uint64_t entityName(const Entity &E) const;
+		bool matchState(const State &S, std::vector<Entity> &Enabled,
+				std::vector<uint64_t> &Names) const;
+		unsigned defaultChoice(const std::vector<Entity> &Enabled);
+		bool isDecisionPoint() const;
+		void closeEvent();
+		void noteThreads(unsigned Parent);
+		void recordEvent(const std::vector<std::pair<void*, bool> > &Footprint,
+				bool Global, uint64_t Name, const Clock *Extra);
+		void addBacktrack(unsigned StateDepth, const Entity &E);
+		void prepareNextTrace();
+
+		public:
+		DPORExplorer();
+
+		// get - The explorer of the process.
+		static DPORExplorer &get();
+
+		// beginTrace/endTrace - Bracket one run of the program.
+		void beginTrace();
+		void endTrace();
+
+		// selectAction - The next action of the run; called before every
+		// instruction, like Scheduler::selectAction.  psoIndex receives the
+		// index of the flushed address among those of the thread under PSO.
+		Action selectAction(const Interpreter *I, unsigned &psoIndex);
+
+		// isComplete - Whether every equivalence class has been explored.
+		bool isComplete() const { return Complete; }
+		// restart - Forget the exploration, e.g. after the program changed.
+		void restart();
+
+		unsigned getNumTraces() const { return Traces; }
+		unsigned getNumClasses() const { return Classes.size(); }
+	};
+
+}
+
+#endif
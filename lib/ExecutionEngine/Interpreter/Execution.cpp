@@ -17,6 +17,8 @@
 #include "Params.h"
 #include "Scheduler.h"
 #include "Constraints.h"
+#include "Predictor.h"
+#include "TraceChecker.h"
 #include "llvm/Constants.h"
 #include "llvm/DerivedTypes.h"
 #include "llvm/Instructions.h"
@@ -46,8 +48,6 @@
 #include <sys/time.h>
 #include <time.h>
 
-clock_t timeofChecking;
-
 using std::cout;
 using std::endl;
 using namespace llvm;
@@ -61,9 +61,95 @@ static cl::opt<bool> PrintVolatile("interpreter-print-volatile", cl::Hidden,
 //                     Various Helper Functions
 //===----------------------------------------------------------------------===//
 
-static void SetValue(Value *V, GenericValue Val, ExecutionContext &SF)
+static void SetValue(Value *V, const GenericValue &Val, ExecutionContext &SF)
+{
+	SF.getValue(V) = Val;
+}
+
+//===----------------------------------------------------------------------===//
+//                    Narrow Integer Fast Paths
+//===----------------------------------------------------------------------===//
+//
+// Integers of 64 bits or less, i.e. every i1, i8, i32 and i64 of a DFENCE
+// program, live in a single word of the APInt.  The helpers below compute on
+// that word directly; the general APInt algorithms are only used for wider
+// integers.
+
+// getNarrowWidth - The bit width of Ty if it is an integer of at most 64 bits,
+// 0 otherwise.
+static inline unsigned getNarrowWidth(const Type *Ty)
+{
+	if (const IntegerType *ITy = dyn_cast<IntegerType>(Ty))
+		if (ITy->getBitWidth() <= 64)
+			return ITy->getBitWidth();
+	return 0;
+}
+
+static inline int64_t signExtendNarrow(uint64_t V, unsigned Width)
+{
+	return (int64_t)(V << (64 - Width)) >> (64 - Width);
+}
+
+// executeNarrowBinary - Compute an integer binary operator on Width-bit
+// operands.  Returns false for the opcodes it does not handle.
+static bool executeNarrowBinary(unsigned Opcode, unsigned Width,
+		uint64_t A, uint64_t B, uint64_t &Res)
+{
+	switch (Opcode)
+	{
+		case Instruction::Add:  Res = A + B; return true;
+		case Instruction::Sub:  Res = A - B; return true;
+		case Instruction::Mul:  Res = A * B; return true;
+		case Instruction::And:  Res = A & B; return true;
+		case Instruction::Or:   Res = A | B; return true;
+		case Instruction::Xor:  Res = A ^ B; return true;
+		case Instruction::UDiv: Res = A / B; return true;
+		case Instruction::URem: Res = A % B; return true;
+		case Instruction::SDiv:
+		case Instruction::SRem:
+		{
+			int64_t SA = signExtendNarrow(A, Width), SB = signExtendNarrow(B, Width);
+			// x / -1 is computed as a negation so that INT64_MIN / -1 wraps like
+			// APInt instead of trapping.
+			if (SB == -1)
+				Res = Opcode == Instruction::SDiv ? 0 - A : 0;
+			else
+				Res = Opcode == Instruction::SDiv ? (uint64_t)(SA / SB) : (uint64_t)(SA % SB);
+			return true;
+		}
+		case Instruction::Shl:
+			Res = B < Width ? A << B : A;
+			return true;
+		case Instruction::LShr:
+			Res = B < Width ? A >> B : A;
+			return true;
+		case Instruction::AShr:
+			Res = B < Width ? (uint64_t)(signExtendNarrow(A, Width) >> B) : A;
+			return true;
+		default:
+			return false;
+	}
+}
+
+// executeNarrowICmp - Compare two Width-bit integers.
+static bool executeNarrowICmp(unsigned Predicate, unsigned Width,
+		uint64_t A, uint64_t B)
 {
-	SF.Values[V] = Val;
+	switch (Predicate)
+	{
+		case ICmpInst::ICMP_EQ:  return A == B;
+		case ICmpInst::ICMP_NE:  return A != B;
+		case ICmpInst::ICMP_ULT: return A < B;
+		case ICmpInst::ICMP_UGT: return A > B;
+		case ICmpInst::ICMP_ULE: return A <= B;
+		case ICmpInst::ICMP_UGE: return A >= B;
+		case ICmpInst::ICMP_SLT: return signExtendNarrow(A, Width) < signExtendNarrow(B, Width);
+		case ICmpInst::ICMP_SGT: return signExtendNarrow(A, Width) > signExtendNarrow(B, Width);
+		case ICmpInst::ICMP_SLE: return signExtendNarrow(A, Width) <= signExtendNarrow(B, Width);
+		case ICmpInst::ICMP_SGE: return signExtendNarrow(A, Width) >= signExtendNarrow(B, Width);
+		default:
+			llvm_unreachable("Don't know how to handle this ICmp predicate!");
+	}
 }
 
 //===----------------------------------------------------------------------===//
@@ -313,10 +399,18 @@ void Interpreter::visitICmpInst(ICmpInst &I)
 {
 	ExecutionContext &SF = ECStack->back();
 	const Type *Ty    = I.getOperand(0)->getType();
-	GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
-	GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
+	GenericValue Src1 = getDecodedOperand(0, SF);
+	GenericValue Src2 = getDecodedOperand(1, SF);
 	GenericValue R;   // Result
 
+	if (unsigned Width = getNarrowWidth(Ty))
+	{
+		R.IntVal = APInt(1, executeNarrowICmp(I.getPredicate(), Width,
+					Src1.IntVal.getZExtValue(), Src2.IntVal.getZExtValue()));
+		setDecodedResult(R, SF);
+		return;
+	}
+
 	switch (I.getPredicate())
 	{
 		case ICmpInst::ICMP_EQ:
@@ -354,7 +448,7 @@ void Interpreter::visitICmpInst(ICmpInst &I)
 			llvm_unreachable(0);
 	}
 
-	SetValue(&I, R, SF);
+	setDecodedResult(R, SF);
 }
 
 #define IMPLEMENT_FCMP(OP, TY) \
@@ -543,8 +637,8 @@ void Interpreter::visitFCmpInst(FCmpInst &I)
 {
 	ExecutionContext &SF = ECStack->back();
 	const Type *Ty    = I.getOperand(0)->getType();
-	GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
-	GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
+	GenericValue Src1 = getDecodedOperand(0, SF);
+	GenericValue Src2 = getDecodedOperand(1, SF);
 	GenericValue R;   // Result
 
 	switch (I.getPredicate())
@@ -602,7 +696,7 @@ void Interpreter::visitFCmpInst(FCmpInst &I)
 			llvm_unreachable(0);
 	}
 
-	SetValue(&I, R, SF);
+	setDecodedResult(R, SF);
 }
 
 static GenericValue executeCmpInst(unsigned predicate, GenericValue Src1,
@@ -681,10 +775,20 @@ void Interpreter::visitBinaryOperator(BinaryOperator &I)
 {
 	ExecutionContext &SF = ECStack->back();
 	const Type *Ty    = I.getOperand(0)->getType();
-	GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
-	GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
+	GenericValue Src1 = getDecodedOperand(0, SF);
+	GenericValue Src2 = getDecodedOperand(1, SF);
 	GenericValue R;   // Result
 
+	uint64_t Res;
+	if (unsigned Width = getNarrowWidth(Ty))
+		if (executeNarrowBinary(I.getOpcode(), Width, Src1.IntVal.getZExtValue(),
+					Src2.IntVal.getZExtValue(), Res))
+		{
+			R.IntVal = APInt(Width, Res);
+			setDecodedResult(R, SF);
+			return;
+		}
+
 	switch (I.getOpcode())
 	{
 		case Instruction::Add:
@@ -737,7 +841,7 @@ void Interpreter::visitBinaryOperator(BinaryOperator &I)
 			llvm_unreachable(0);
 	}
 
-	SetValue(&I, R, SF);
+	setDecodedResult(R, SF);
 }
 
 static GenericValue executeSelectInst(GenericValue Src1, GenericValue Src2,
@@ -749,11 +853,9 @@ static GenericValue executeSelectInst(GenericValue Src1, GenericValue Src2,
 void Interpreter::visitSelectInst(SelectInst &I)
 {
 	ExecutionContext &SF = ECStack->back();
-	GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
-	GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
-	GenericValue Src3 = getOperandValue(I.getOperand(2), SF);
-	GenericValue R = executeSelectInst(Src1, Src2, Src3);
-	SetValue(&I, R, SF);
+	// Only the operand that is selected is read.
+	bool Cond = getDecodedOperand(0, SF).IntVal.getZExtValue() != 0;
+	setDecodedResult(getDecodedOperand(Cond ? 1 : 2, SF), SF);
 }
 
 
@@ -782,14 +884,12 @@ void Interpreter::exitCalled(GenericValue GV)
 void Interpreter::popStackAndReturnValueToCaller(const Type *RetTy,
 		GenericValue Result)
 {
-	// before popping the stack free the memory pointed to by Allocas
-	ExecutionContext& SF = ECStack->back();
-	freeAllocas(SF);
-	// Pop the current stack frame.
+	// Pop the current stack frame, which also frees its allocas.
 	ECStack->pop_back();
 
 	if (ECStack->empty())    // Finished main.  Put result into exit code...
 	{
+		setThreadEnabled(ECStack->Owner, false);
 		if (RetTy && RetTy->isIntegerTy())            // Nonvoid return type?
 		{
 			ExitValue = Result;   // Capture the exit value of the program
@@ -807,8 +907,8 @@ void Interpreter::popStackAndReturnValueToCaller(const Type *RetTy,
 		if (Instruction *I = CallingSF.Caller.getInstruction())
 		{
 			// Save result...
-			if (!CallingSF.Caller.getType()->isVoidTy())
-				SetValue(I, Result, CallingSF);
+			if (CallingSF.CallerResult != DecodedInst::NoSlot)
+				CallingSF.Values[CallingSF.CallerResult] = Result;
 			if (InvokeInst *II = dyn_cast<InvokeInst> (I))
 				SwitchToNewBasicBlock (II->getNormalDest (), CallingSF);
 			CallingSF.Caller = CallSite();          // We returned from the call...
@@ -826,10 +926,10 @@ void Interpreter::visitReturnInst(ReturnInst &I)
 	if (I.getNumOperands())
 	{
 		RetTy  = I.getReturnValue()->getType();
-		Result = getOperandValue(I.getReturnValue(), SF);
+		Result = getDecodedOperand(0, SF);
 	}
 
-	history->RecordReturnEvent(RetTy, Result, SF.CurFunction, currThread);
+	history->RecordReturnEvent(RetTy, Result, SF.CurFunction, SF.FuncInfo->Recorded, currThread);
 	popStackAndReturnValueToCaller(RetTy, Result);
 }
 
@@ -910,37 +1010,32 @@ void Interpreter::visitIndirectBrInst(IndirectBrInst &I)
 // atomically, reading their inputs before any of the results are updated.  Not
 // doing this can cause problems if the PHI nodes depend on other PHI nodes for
 // their inputs.  If the input PHI node is updated before it is read, incorrect
-// results can happen.  Thus we use a two phase approach.
+// results can happen.  Thus we use a two phase approach.  The PHI nodes of
+// each edge were turned into a list of slot copies when the function was
+// decoded, and the new instruction ptr starts past them.
 //
 void Interpreter::SwitchToNewBasicBlock(BasicBlock *Dest, ExecutionContext &SF)
 {
 	BasicBlock *PrevBB = SF.CurBB;      // Remember where we came from...
 	SF.CurBB   = Dest;                  // Update CurBB to branch destination
-	SF.CurInst = SF.CurBB->begin();     // Update new instruction ptr...
-
-	if (!isa<PHINode>(SF.CurInst)) return;  // Nothing fancy to do
+	const DecodedBlock &DB = SF.FuncInfo->getBlock(Dest);
+	SF.CurInst = &SF.FuncInfo->Code[DB.Start]; // Update new instruction ptr...
 
-	// Loop over all of the PHI nodes in the current block, reading their inputs.
-	std::vector<GenericValue> ResultValues;
+	if (DB.Edges.empty()) return;       // Nothing fancy to do
 
-	for (; PHINode *PN = dyn_cast<PHINode>(SF.CurInst); ++SF.CurInst)
+	// Read the inputs of all of the PHI nodes for the edge we came over...
+	const std::vector<PHICopy> &Copies = DB.getPHICopies(PrevBB);
+	PHIValues.clear();
+	for (unsigned i = 0, e = Copies.size(); i != e; ++i)
 	{
-		// Search for the value corresponding to this previous bb...
-		int i = PN->getBasicBlockIndex(PrevBB);
-		ASSERT(i != -1, "PHINode doesn't contain entry for predecessor??");
-		Value *IncomingValue = PN->getIncomingValue(i);
-
-		// Save the incoming value for this PHI node...
-		ResultValues.push_back(getOperandValue(IncomingValue, SF));
+		const PHICopy &C = Copies[i];
+		PHIValues.push_back(C.Src != DecodedInst::NoSlot ? SF.Values[C.Src]
+				: getOperandValue(C.SrcVal, SF));
 	}
 
-	// Now loop over all of the PHI nodes setting their values...
-	SF.CurInst = SF.CurBB->begin();
-	for (unsigned i = 0; isa<PHINode>(SF.CurInst); ++SF.CurInst, ++i)
-	{
-		PHINode *PN = cast<PHINode>(SF.CurInst);
-		SetValue(PN, ResultValues[i], SF);
-	}
+	// Now set all of their values...
+	for (unsigned i = 0, e = Copies.size(); i != e; ++i)
+		SF.Values[Copies[i].Dest] = PHIValues[i];
 }
 
 //===----------------------------------------------------------------------===//
@@ -962,17 +1057,19 @@ void Interpreter::visitAllocaInst(AllocaInst &I)
 	// Avoid malloc-ing zero bytes, use max()...
 	unsigned MemToAlloc = std::max(1U, NumElements * TypeSize);
 
-	// Allocate enough memory to hold the type...
+	// Allocate enough memory to hold the type on the stack of the thread...
 #if defined(VIRTUALMEMORY)
-	void *nativeAddr = malloc(MemToAlloc);
-	void *virtualAddr = (void *)nextVirtualAddress;
-	nextVirtualAddress = nextVirtualAddress + (int)MemToAlloc;
-	nextVirtualAddress += MEMDIFF;
-	nextVirtualAddress = (size_t)makeAddressAlligned((void*)nextVirtualAddress);
-	nativeToVirtual[nativeAddr] = virtualAddr;
-	virtualToNative[virtualAddr] = nativeAddr;
+	void *nativeAddr = ECStack->allocate(MemToAlloc);
+	if (ECStack->VirtualBase == NULL) {
+		// the whole alloca stack of the thread gets one virtual range
+		ECStack->VirtualBase = (char *)nextVirtualAddress;
+		nextVirtualAddress = nextVirtualAddress + (int)ExecutionStack::AllocaStackSize;
+		nextVirtualAddress += MEMDIFF;
+		nextVirtualAddress = (size_t)makeAddressAlligned((void*)nextVirtualAddress);
+	}
+	void *virtualAddr = (void *)( (size_t)nativeAddr - (size_t)ECStack->allocaBase() + (size_t)ECStack->VirtualBase );
 #else
-	void *virtualAddr = malloc(MemToAlloc);
+	void *virtualAddr = ECStack->allocate(MemToAlloc);
 #endif
 
 	DEBUG(dbgs() << "Allocated Type: " << *Ty << " (" << TypeSize << " bytes) x "
@@ -982,12 +1079,6 @@ void Interpreter::visitAllocaInst(AllocaInst &I)
 	GenericValue Result = PTOGV(virtualAddr);
 	ASSERT(Result.PointerVal != 0, "Null pointer returned by malloc!");
 	SetValue(&I, Result, SF);
-
-	// changed to insert with number of bytes when on relaxed memory model
-	if (I.getOpcode() == Instruction::Alloca) {
-		//ECStack->back().Allocas.add(Memory);
-		SF.Allocas.addWithSize(virtualAddr,MemToAlloc);
-	}
 }
 
 // getElementOffset - The workhorse for getelementptr.
@@ -1048,9 +1139,10 @@ void Interpreter::visitGetElementPtrInst(GetElementPtrInst &I)
 /* support store memory operation */
 void Interpreter::visitStoreInstNoWmm(StoreInst &I) {
 	ExecutionContext &SF = ECStack->back();
-	GenericValue Val = getOperandValue(I.getOperand(0), SF);
+	noteProgress();  // a loop that stores, even to its stack, is no spin
+	GenericValue Val = getDecodedOperand(0, SF);
 #if defined(VIRTUALMEMORY)
-	GenericValue virSRC = getOperandValue(I.getPointerOperand(), SF);
+	GenericValue virSRC = getDecodedOperand(1, SF);
 	GenericValue natSRC = virSRC;
 	natSRC.PointerVal = getNativeAddressFull(virSRC.PointerVal,SF);
 	StoreValueToMemory(Val, (GenericValue *)GVTOP(natSRC),
@@ -1059,15 +1151,19 @@ void Interpreter::visitStoreInstNoWmm(StoreInst &I) {
 	if (!isAddressOnStack(virSRC.PointerVal, SF)) {	
 		rw_history->RecordRWEvent(virSRC, Val, currThread, WRITE, I.label_instr);
 		instr_info.isSharedAccessing = true; // added
+		instr_info.addr = (size_t)virSRC.PointerVal;
+		noteMemoryWrite(virSRC.PointerVal, TD.getTypeStoreSize(I.getOperand(0)->getType()));
 	}
 #else
-	GenericValue SRC = getOperandValue(I.getPointerOperand(), SF);
+	GenericValue SRC = getDecodedOperand(1, SF);
 	StoreValueToMemory(Val, (GenericValue *)GVTOP(SRC),
 			I.getOperand(0)->getType());
 	// logging rw non-local accesses
 	if (!isAddressOnStack(SRC.PointerVal, SF)) {	
 		rw_history->RecordRWEvent(SRC, Val, currThread, WRITE, I.label_instr);
 		instr_info.isSharedAccessing = true; // added
+		instr_info.addr = (size_t)SRC.PointerVal;
+		noteMemoryWrite(SRC.PointerVal, TD.getTypeStoreSize(I.getOperand(0)->getType()));
 	}
 #endif
 	if (I.isVolatile() && PrintVolatile)
@@ -1077,9 +1173,11 @@ void Interpreter::visitStoreInstNoWmm(StoreInst &I) {
 void Interpreter::visitStoreInstTSO(StoreInst &I) {
 	tso_buff_elem elem;
 	ExecutionContext &SF = ECStack->back();
-	elem.value = getOperandValue(I.getOperand(0), SF);         // Val
-	elem.pointer = getOperandValue(I.getPointerOperand(), SF); // virSRC 
+	noteProgress();
+	elem.value = getDecodedOperand(0, SF);         // Val
+	elem.pointer = getDecodedOperand(1, SF); // virSRC 
 	elem.type = const_cast<Type*>(I.getOperand(0)->getType());
+	elem.label = I.label_instr;
 	
 	// Add check if the address is local(on the stack)
 	if(isAddressOnStack(elem.pointer.PointerVal,SF)) {
@@ -1097,14 +1195,16 @@ void Interpreter::visitStoreInstTSO(StoreInst &I) {
 	// logging read/write non-local accesses
 	rw_history->RecordRWEvent(elem.pointer, elem.value, currThread, WRITE, I.label_instr);
 	instr_info.isSharedAccessing = true; // added
+	instr_info.addr = (size_t)elem.pointer.PointerVal;
 	if (I.isVolatile() && PrintVolatile)
 		dbgs() << "Volatile store: " << I;
 }
 
 void Interpreter::visitStoreInstPSO(StoreInst &I) {
 	ExecutionContext &SF = ECStack->back();
-	GenericValue Val = getOperandValue(I.getOperand(0), SF);
-	GenericValue virSRC = getOperandValue(I.getPointerOperand(), SF); 
+	noteProgress();
+	GenericValue Val = getDecodedOperand(0, SF);
+	GenericValue virSRC = getDecodedOperand(1, SF);
 
 	if(isAddressOnStack(virSRC.PointerVal,SF)) {
 		GenericValue natSRC = virSRC;
@@ -1115,24 +1215,12 @@ void Interpreter::visitStoreInstPSO(StoreInst &I) {
 		return;
 	}
 
-	pso_types[getOperandValue(I.getPointerOperand(), SF)] = const_cast<Type*>(I.getOperand(0)->getType());
-	thread_buffer_pso[currThread][getOperandValue(I.getPointerOperand(), SF)].push_back(getOperandValue(I.getOperand(0), SF));
+	thread_buffer_pso[currThread].push_back(virSRC.PointerVal, Val,
+			const_cast<Type*>(I.getOperand(0)->getType()), I.label_instr);
 	// logging read/write non-local accesses
 	rw_history->RecordRWEvent(virSRC, Val, currThread, WRITE, I.label_instr);
 	instr_info.isSharedAccessing = true; // added
-}
-
-void Interpreter::visitStoreInst(StoreInst &I) {
-	instr_info.isWriteOrRead = false; // added: this is a write instruction
-	if (Params::WMM == WMM_NONE)	
-		visitStoreInstNoWmm(I);
-	else if (Params::WMM == WMM_TSO)
-		visitStoreInstTSO(I);
-	else if (Params::WMM == WMM_PSO)
-		visitStoreInstPSO(I);
-	else {
-		ASSERT(false, "Failed to invoke visitStoreInst");
-	}
+	instr_info.addr = (size_t)virSRC.PointerVal;
 }
 
 /* support load memory operation */
@@ -1160,7 +1248,7 @@ GenericValue Interpreter::loadValueNoWmm(void *virAddr, const Type* type) {
 void Interpreter::visitLoadInstNoWmm(LoadInst &I) {
 	ExecutionContext &SF = ECStack->back();
 #if defined(VIRTUALMEMORY)
-	GenericValue virSRC = getOperandValue(I.getPointerOperand(), SF);
+	GenericValue virSRC = getDecodedOperand(0, SF);
 	GenericValue natSRC = virSRC;
 	natSRC.PointerVal = getNativeAddressFull(virSRC.PointerVal, SF);
 	GenericValue *natPtr = (GenericValue*)GVTOP(natSRC);
@@ -1170,9 +1258,11 @@ void Interpreter::visitLoadInstNoWmm(LoadInst &I) {
 	if (!isAddressOnStack(virSRC.PointerVal, SF)) {
 		rw_history->RecordRWEvent(virSRC, Result, currThread, READ, I.label_instr);
 		instr_info.isSharedAccessing = true; //added
+		instr_info.addr = (size_t)virSRC.PointerVal;
+		noteSharedRead(virSRC.PointerVal);
 	}
 #else
-	GenericValue SRC = getOperandValue(I.getPointerOperand(), SF);
+	GenericValue SRC = getDecodedOperand(0, SF);
 	GenericValue *Ptr = (GenericValue*)GVTOP(SRC);
 	GenericValue Result;
 	LoadValueFromMemory(Result, Ptr, I.getType());
@@ -1180,9 +1270,11 @@ void Interpreter::visitLoadInstNoWmm(LoadInst &I) {
 	if (!isAddressOnStack(SRC.PointerVal, SF)) {
 		rw_history->RecordRWEvent(SRC, Result, currThread, READ, I.label_instr);
 		instr_info.isSharedAccessing = true; //added
+		instr_info.addr = (size_t)SRC.PointerVal;
+		noteSharedRead(SRC.PointerVal);
 	}
 #endif
-	SetValue(&I, Result, SF);
+	setDecodedResult(Result, SF);
 	if (I.isVolatile() && PrintVolatile)
 		dbgs() << "Volatile load " << I;
 }
@@ -1215,21 +1307,17 @@ GenericValue Interpreter::loadValueTSO(void *virAddr, const Type *type) {
 */
 void Interpreter::visitLoadInstTSO(LoadInst &I) {
 	ExecutionContext &SF = ECStack->back();
-	GenericValue virSRC = getOperandValue(I.getPointerOperand(), SF);
-	std::list<tso_buff_elem>::reverse_iterator it = thread_buffer_tso[currThread].rbegin();
+	GenericValue virSRC = getDecodedOperand(0, SF);
 	GenericValue Result;
 
-	bool fl = false;
-	for ( ; it != thread_buffer_tso[currThread].rend(); ++it) {
-		if (it->pointer.PointerVal == virSRC.PointerVal) {
-			Result = it->value;
-			SetValue(&I, Result, SF);
-			fl = true;
-			rw_history->RecordRWEvent(virSRC, Result, currThread, READ, I.label_instr);
-			break;
-		}
-	}
-	if (!fl) {
+	if (const tso_buff_elem *Buffered =
+			thread_buffer_tso[currThread].findNewest(virSRC.PointerVal)) {
+		// forwarded from the own buffer: no other thread can change it, so
+		// it does not count towards a spin
+		Result = Buffered->value;
+		setDecodedResult(Result, SF);
+		rw_history->RecordRWEvent(virSRC, Result, currThread, READ, I.label_instr);
+	} else {
 		GenericValue natSRC = virSRC;
 #if defined(VIRTUALMEMORY)
 		natSRC.PointerVal = getNativeAddressFull(virSRC.PointerVal, SF);
@@ -1240,8 +1328,10 @@ void Interpreter::visitLoadInstTSO(LoadInst &I) {
 		if (!isAddressOnStack(virSRC.PointerVal,SF)) {
 			rw_history->RecordRWEvent(virSRC, Result, currThread, READ, I.label_instr);
 			instr_info.isSharedAccessing = true; //added
+			instr_info.addr = (size_t)virSRC.PointerVal;
+			noteSharedRead(virSRC.PointerVal);
 		}
-		SetValue(&I, Result, SF);
+		setDecodedResult(Result, SF);
 	}
 	if (I.isVolatile() && PrintVolatile)
 		dbgs() << "Volatile load " << I;
@@ -1269,16 +1359,19 @@ GenericValue Interpreter::loadValuePSO(void *virAddr, const Type *type) {
 
 void Interpreter::visitLoadInstPSO(LoadInst &I) {
 	ExecutionContext &SF = ECStack->back();
+	GenericValue virSRC = getDecodedOperand(0, SF);
 	GenericValue Result;
 
-	if (!thread_buffer_pso[currThread][getOperandValue(I.getPointerOperand(), SF)].empty()) {
-		Result = thread_buffer_pso[currThread][getOperandValue(I.getPointerOperand(), SF)].back();
+	if (const pso_buff_elem *Buffered =
+			thread_buffer_pso[currThread].findNewest(virSRC.PointerVal)) {
+		// forwarded, as under TSO: not noted as a spinning read
+		Result = Buffered->value;
 		// logging read/write non-local accesses
-		if (!isAddressOnStack(getOperandValue(I.getPointerOperand(), SF).PointerVal,SF)) {
+		if (!isAddressOnStack(virSRC.PointerVal,SF)) {
 
 #if defined(VIRTUALMEMORY) 
 	// added to track segment fault
-	void *virtualAddr = getOperandValue(I.getPointerOperand(),SF).PointerVal;
+	void *virtualAddr = virSRC.PointerVal;
 	void *virtualBase = getVirtualBaseAddressHeap(virtualAddr);
 	if (virtualBase == NULL) {
 		segmentFaultFlag = true;
@@ -1286,7 +1379,7 @@ void Interpreter::visitLoadInstPSO(LoadInst &I) {
 	}
 #else
 	// added to track segment fault
-	void *virtualAddr = getOperandValue(I.getPointerOperand(),SF).PointerVal;
+	void *virtualAddr = virSRC.PointerVal;
 	void *virtualBase = getPhysicalBaseAddressHeap(virtualAddr);
 	if (virtualBase == NULL) {
 		segmentFaultFlag = true;
@@ -1294,12 +1387,12 @@ void Interpreter::visitLoadInstPSO(LoadInst &I) {
 	}
 #endif
 
-			rw_history->RecordRWEvent(getOperandValue(I.getPointerOperand(), SF), Result, currThread, READ, I.label_instr);
+			rw_history->RecordRWEvent(virSRC, Result, currThread, READ, I.label_instr);
 			instr_info.isSharedAccessing = true; // added
+			instr_info.addr = (size_t)virSRC.PointerVal;
 		}
-		SetValue(&I, Result, SF);
+		setDecodedResult(Result, SF);
 	} else {
-		GenericValue virSRC = getOperandValue(I.getPointerOperand(), SF);
 		GenericValue natSRC = virSRC;
 #if defined(VIRTUALMEMORY)
 		natSRC.PointerVal = getNativeAddressFull(virSRC.PointerVal, SF);
@@ -1310,7 +1403,7 @@ void Interpreter::visitLoadInstPSO(LoadInst &I) {
 
 #if defined(VIRTUALMEMORY) 
 	// added to track segment fault
-	void *virtualAddr = getOperandValue(I.getPointerOperand(),SF).PointerVal;
+	void *virtualAddr = virSRC.PointerVal;
 	void *virtualBase = getVirtualBaseAddressHeap(virtualAddr);
 	if (virtualBase == NULL) {
 		segmentFaultFlag = true;
@@ -1318,7 +1411,7 @@ void Interpreter::visitLoadInstPSO(LoadInst &I) {
 	}
 #else
 	// added to track segment fault
-	void *virtualAddr = getOperandValue(I.getPointerOperand(),SF).PointerVal;
+	void *virtualAddr = virSRC.PointerVal;
 	void *virtualBase = getPhysicalBaseAddressHeap(virtualAddr);
 	if (virtualBase == NULL) {
 		segmentFaultFlag = true;
@@ -1328,33 +1421,23 @@ void Interpreter::visitLoadInstPSO(LoadInst &I) {
 
 			rw_history->RecordRWEvent(virSRC, Result, currThread, READ, I.label_instr);
 			instr_info.isSharedAccessing = true; // added
+			instr_info.addr = (size_t)virSRC.PointerVal;
+			noteSharedRead(virSRC.PointerVal);
 		}
 
 		GenericValue *Ptr = (GenericValue*)GVTOP(natSRC);
 		LoadValueFromMemory(Result, Ptr, I.getType());
 
-		SetValue(&I, Result, SF);
-	}
-}
-
-void Interpreter::visitLoadInst(LoadInst &I) {
-	instr_info.isWriteOrRead = true; // this is a read instruction
-	if (Params::WMM == WMM_NONE)	
-		visitLoadInstNoWmm(I);
-	else if (Params::WMM == WMM_TSO)
-		visitLoadInstTSO(I);
-	else if (Params::WMM == WMM_PSO)
-		visitLoadInstPSO(I);
-	else {
-		ASSERT(false, "Failed to invoke visitStoreInst");
+		setDecodedResult(Result, SF);
 	}
 }
 
 /* support flush buffer and fence instructions */
 void Interpreter::flush_buffer_pso(Thread t, GenericValue p) {
-	if (!thread_buffer_pso[t][p].empty()) {
-		GenericValue v = thread_buffer_pso[t][p].front();
-		thread_buffer_pso[t][p].pop_front();
+	PSOBuffer &buffer = thread_buffer_pso[t];
+	if (!buffer.empty(p.PointerVal)) {
+		pso_buff_elem elem = buffer.front(p.PointerVal);
+		buffer.pop_front(p.PointerVal);
 		GenericValue native = p;
 #if defined(VIRTUALMEMORY)
 		native.PointerVal = getNativeAddressGlobal(p.PointerVal);
@@ -1378,26 +1461,22 @@ void Interpreter::flush_buffer_pso(Thread t, GenericValue p) {
 	}
 #endif
 
-		StoreValueToMemory(v, (GenericValue *)GVTOP(native), pso_types[p]);
+		StoreValueToMemory(elem.value, (GenericValue *)GVTOP(native), elem.type);
+		noteMemoryWrite(p.PointerVal, TD.getTypeStoreSize(elem.type));
 	}
 }
 
 void Interpreter::flush_buffer_tso(Thread t) {
-	if (!thread_buffer_tso[t].empty()) {
-		tso_buff_elem elem = thread_buffer_tso[t].front();
-		GenericValue Val;
-		GenericValue virSRC;
-		Type* type;
-
-		thread_buffer_tso[t].pop_front();
-		Val = elem.value;
-		virSRC = elem.pointer;
-		type = elem.type;
-		GenericValue natSRC = virSRC;
+	TSOBuffer &buffer = thread_buffer_tso[t];
+	if (!buffer.empty()) {
+		const tso_buff_elem &elem = buffer.front();
+		GenericValue natSRC = elem.pointer;
 #if defined(VIRTUALMEMORY)
-		natSRC.PointerVal = getNativeAddressGlobal(virSRC.PointerVal);
+		natSRC.PointerVal = getNativeAddressGlobal(elem.pointer.PointerVal);
 #endif
-		StoreValueToMemory(Val, (GenericValue *)GVTOP(natSRC), type);
+		StoreValueToMemory(elem.value, (GenericValue *)GVTOP(natSRC), elem.type);
+		noteMemoryWrite(elem.pointer.PointerVal, TD.getTypeStoreSize(elem.type));
+		buffer.pop_front();
 	}
 }
 
@@ -1408,12 +1487,9 @@ void Interpreter::membar_ss(Thread t) {
 	} else if (Params::WMM == WMM_TSO) {
 		printf("warning: membar_ss has no effect on TSO WMM.\n");
 	} else if (Params::WMM == WMM_PSO) {
-		std::map<GenericValue, std::list<GenericValue> >::iterator mit;
-		mit = thread_buffer_pso[t].begin();
-		for ( ; mit != thread_buffer_pso[t].end(); ++mit) {
-			while (!mit->second.empty()) {
-				flush_buffer_pso(t, mit->first);
-			}
+		PSOBuffer &buffer = thread_buffer_pso[t];
+		while (!buffer.empty()) {
+			flush_buffer_pso(t, GenericValue(buffer.getAddress(0)));
 		}
 	}
 	rw_history->RecordRWEvent(t, FLUSH_FENCE, 0); // added
@@ -1427,12 +1503,9 @@ void Interpreter::membar_sl(Thread t) {
 			flush_buffer_tso(t);
 		}
 	} else if (Params::WMM == WMM_PSO) {
-		std::map<GenericValue, std::list<GenericValue> >::iterator mit;
-		mit = thread_buffer_pso[t].begin();
-		for ( ; mit != thread_buffer_pso[t].end(); ++mit) {
-			while (!mit->second.empty()) {
-				flush_buffer_pso(t, mit->first);
-			}
+		PSOBuffer &buffer = thread_buffer_pso[t];
+		while (!buffer.empty()) {
+			flush_buffer_pso(t, GenericValue(buffer.getAddress(0)));
 		}
 	}
 	// record the flush operation
@@ -1446,6 +1519,7 @@ void Interpreter::visitSpawnThread(ExecutionContext &SF) {
 	Value *V = *SF.Caller.arg_begin(); // get the first parameter
 	ASSERT(V->getType()->isPointerTy(), "spawn_thread must accept pointer type");
 	GenericValue Arg = getOperandValue(V,SF); // this code gets the value of the argument. The argument is the address of the function that the new thread will execute
+	bool checkpointHere = awaitsCheckpoint();
 	createThread(Arg); // create the thread itself
 	history->RecordFirstEvent();
 	// Caller is use when returning from function and poping the stack, we need to know who called the function and eventually return value
@@ -1455,6 +1529,10 @@ void Interpreter::visitSpawnThread(ExecutionContext &SF) {
 
 	// record a sync instruction
 	rw_history->RecordRWEvent(currThread, SPAWN, 0);
+
+	// the later runs of main go on from here
+	if (checkpointHere)
+		takeCheckpoint();
 }
 
 void Interpreter::visitAssert(ExecutionContext &SF) {
@@ -1467,6 +1545,7 @@ void Interpreter::visitAssert(ExecutionContext &SF) {
 	int assertPassed = getOperandValue(assval, SF).IntVal.getLimitedValue();
 	// if assert fails, do something more drastic)
 	if (assertPassed == 0) {
+		assertFailed = true;
 		// Second parameter should be a pointer to a string.
 		iter++;
 		if (iter != SF.Caller.arg_end()) {
@@ -1537,20 +1616,18 @@ void Interpreter::visitJoinAll(ExecutionContext &SF) {
 	//to do for now is roll back the instruction pointer.
 	ASSERT(SF.Caller.arg_size() == 0, "join_all should have no arguments");
 	//Count how many stacks are non-empty. If > 1, then unroll.
-	int liveThreads = 0;
-	std::map<Thread, std::vector<ExecutionContext> >::iterator it;
-	for(it = threadStacks.begin(); it != threadStacks.end(); ++it) {
-		if(!it->second.empty())
-			liveThreads++;
-	}
-	if (liveThreads > 1) {
+	if (getAllActiveThreads().size() > 1) {
 		instr_info.isBlocked = true; // this thread is blocked
+		// it is not run again until the other threads are done
+		setJoinWaiting(currThread, true);
 		SF.CurInst--;
+	} else {
+		setJoinWaiting(currThread, false);
+		// record a sync instruction, once the join is through: FindSharedRW
+		// ignores what follows the first JOIN
+		rw_history->RecordRWEvent(currThread, JOIN, 0);
 	}
 	SF.Caller = CallSite();
-
-	// record a sync instruction
-	rw_history->RecordRWEvent(currThread, JOIN, 0);
 }
 
 /* Works only with integers. */
@@ -1568,7 +1645,7 @@ void Interpreter::visitCAS(ExecutionContext &SF, int inst) {
 			flush_buffer_tso(currThread);
 		}
 	}	else if (Params::WMM == WMM_PSO)	{
-		while (!thread_buffer_pso[currThread][arg1].empty()) {
+		while (!thread_buffer_pso[currThread].empty(arg1.PointerVal)) {
 			flush_buffer_pso(currThread, arg1);
 		}
 	}
@@ -1625,6 +1702,8 @@ void Interpreter::visitCAS(ExecutionContext &SF, int inst) {
 		if (*natAddr == x) {
 			*natAddr = y;
 			ret = 1;
+			noteProgress();
+			noteMemoryWrite(arg1.PointerVal, sizeof(int));
 			if (Params::WMM == WMM_TSO) {
 				rw_history->RecordRWEvent(arg1, arg3, currThread, WRITE, 0);
 			} else if (Params::WMM == WMM_PSO) {
@@ -1632,6 +1711,9 @@ void Interpreter::visitCAS(ExecutionContext &SF, int inst) {
 				Instruction* I = SF.Caller.getInstruction();
 				rw_history->RecordRWEvent(arg1, arg3, currThread, WRITE, I->label_instr);
 			}
+		} else {
+			// a failing cas32 reads the location, as a retry loop does
+			noteSharedRead(arg1.PointerVal);
 		}
 	} else if (inst == CASIO) {
 		ret = *natAddr;
@@ -1669,9 +1751,10 @@ void Interpreter::visitCASPO(ExecutionContext &SF)
 	Value *V = *ait;
 	ASSERT(V->getType()->isPointerTy(), "first argument of caspo must be pointer");
 	GenericValue arg = getOperandValue(V,SF);
+	void *location = arg.PointerVal;
 
 	if (Params::WMM == WMM_PSO)	{
-		while (!thread_buffer_pso[currThread][arg].empty()) {
+		while (!thread_buffer_pso[currThread].empty(arg.PointerVal)) {
 			flush_buffer_pso(currThread, arg);
 		}	
 	}
@@ -1698,6 +1781,10 @@ void Interpreter::visitCASPO(ExecutionContext &SF)
 	if( ret == x )
 	{
 		*((void **)natAddr) = y;
+		noteProgress();
+		noteMemoryWrite(location, sizeof(void*));
+	} else {
+		noteSharedRead(location);
 	}
 	if( Instruction* I = SF.Caller.getInstruction() )
 	{
@@ -1729,6 +1816,7 @@ void Interpreter::visitFASPO(ExecutionContext &SF) {
 	Value *V = *ait;
 	ASSERT(V->getType()->isPointerTy(), "first argument of faspo must be pointer");
 	GenericValue arg = getOperandValue(V,SF);
+	void *location = arg.PointerVal;
 #if defined(VIRTUALMEMORY)
 	void *virAddr = arg.PointerVal;
 	void *natAddr = getNativeAddressFull(virAddr, SF);
@@ -1743,6 +1831,8 @@ void Interpreter::visitFASPO(ExecutionContext &SF) {
 
 	void* ret = *((void **)natAddr);
 	*((void **)natAddr) = x;
+	noteProgress();
+	noteMemoryWrite(location, sizeof(void*));
 	if( Instruction* I = SF.Caller.getInstruction() )
 	{
 		GenericValue Result;
@@ -1765,6 +1855,7 @@ void Interpreter::visitMalloc(ExecutionContext &SF) {
 	// dealing with second layer of memory addressing
 #if defined(VIRTUALMEMORY)
 	void *nativeAddr = malloc(numBytes);
+	mallocBlocks.insert(nativeAddr);
 	void *virtualAddr = (void*)nextVirtualAddress;
 	bytesAtVirtualAddress[virtualAddr] = numBytes;
 	nextVirtualAddress = nextVirtualAddress + numBytes;
@@ -1773,6 +1864,7 @@ void Interpreter::visitMalloc(ExecutionContext &SF) {
 	virtualToNative[virtualAddr] = nativeAddr;
 #else
 	void *virtualAddr = malloc(numBytes);
+	mallocBlocks.insert(virtualAddr);
 	bytesAtPhysicalAddress[virtualAddr] = numBytes;
 #endif
 
@@ -1804,8 +1896,14 @@ void Interpreter::visitFree(ExecutionContext &SF) {
 	}
 
 	void *nativeAddr = virtualToNative[virtualBase];
-	free(nativeAddr);
-	bytesAtVirtualAddress[virtualBase] = 0;
+	// the next trace starts with the object again
+	if (!isCheckpointBlock(nativeAddr))
+		free(nativeAddr);
+	mallocBlocks.erase(nativeAddr);
+	// reclaim the range so that lookups do not have to skip over it
+	bytesAtVirtualAddress.erase(virtualBase);
+	virtualToNative.erase(virtualBase);
+	nativeToVirtual.erase(nativeAddr);
 #else
 	void *virtualAddr = arg.PointerVal;
 	void *virtualBase = getPhysicalBaseAddressHeap(virtualAddr);
@@ -1815,8 +1913,12 @@ void Interpreter::visitFree(ExecutionContext &SF) {
 	if (virtualBase != virtualAddr) {
 		ASSERT(0, "pointer for free is not base pointer");
 	}
-	free(virtualBase);
-	bytesAtPhysicalAddress[virtualBase] = 0;
+	// the next trace starts with the object again
+	if (!isCheckpointBlock(virtualBase))
+		free(virtualBase);
+	mallocBlocks.erase(virtualBase);
+	// reclaim the range so that lookups do not have to skip over it
+	bytesAtPhysicalAddress.erase(virtualBase);
 #endif
 
 	SF.Caller = CallSite();
@@ -1853,6 +1955,7 @@ void Interpreter::visitMemset(ExecutionContext &SF) {
 	int size = arg.IntVal.getLimitedValue();
 	virPtr = memset(virPtr, value, size);
 #endif
+	noteMemoryWrite(virPtr, size);
 	if (Instruction *I = SF.Caller.getInstruction()) {
 		GenericValue Result;
 		Result.PointerVal = virPtr;
@@ -1888,6 +1991,7 @@ void Interpreter::visitMemcpy(ExecutionContext &SF, CallSite CS) {
 #endif
 	if (Params::WMM == WMM_NONE) {
 		memcpy(natDest, natSrc, size);
+		noteMemoryWrite(virDest, size);
 	}
 	else if (Params::WMM == WMM_TSO) {
 		// for heap locations, do not perform the memcpy immediately.
@@ -1909,24 +2013,20 @@ void Interpreter::visitMemcpy(ExecutionContext &SF, CallSite CS) {
 			{
 				tso_buff_elem elem;
 				GenericValue gv;
-				std::list<tso_buff_elem>::reverse_iterator it = thread_buffer_tso[currThread].rbegin();
 
 				bool fl = false;
 				//Default granularity is 4 bytes, but if there's a type of a different
 				//size on the buffer, then advance by that much. At least, in theory.
 				int toadd = 4;
-				for ( ; it != thread_buffer_tso[currThread].rend(); ++it)
+				if (const tso_buff_elem *Buffered =
+						thread_buffer_tso[currThread].findNewest((char *)virSrc + offset))
 				{
-					if (it->pointer.PointerVal == (char *)virSrc + offset)
-					{
-						elem.value = it->value;
-						elem.type = it->type;
-						toadd = getTargetData()->getTypeStoreSize(elem.type);
-						//In practice however, we want this to be 4!)
-						ASSERT(toadd == 4, "Unalgined type is on the buffer");
-						fl = true;
-						break;
-					}
+					elem.value = Buffered->value;
+					elem.type = Buffered->type;
+					toadd = getTargetData()->getTypeStoreSize(elem.type);
+					//In practice however, we want this to be 4!)
+					ASSERT(toadd == 4, "Unalgined type is on the buffer");
+					fl = true;
 				}
 
 				if (!fl)
@@ -1937,6 +2037,7 @@ void Interpreter::visitMemcpy(ExecutionContext &SF, CallSite CS) {
 					elem.type = (Type*)Type::getInt32Ty(CS.getInstruction()->getContext());
 				}
 				elem.pointer = GenericValue((char *)virDest + offset);
+				elem.label = SF.Caller.getInstruction()->label_instr;
 				thread_buffer_tso[currThread].push_back(elem);
 
 				// Not sure whether we need this or not
@@ -1971,7 +2072,10 @@ void Interpreter::visitMemcpy(ExecutionContext &SF, CallSite CS) {
 			{
 				GenericValue gv;
 				const Type* storeType;
-				if (thread_buffer_pso[currThread][GenericValue((char*)virSrc + offset)].empty())
+				PSOBuffer &buffer = thread_buffer_pso[currThread];
+				const pso_buff_elem *srcElem = buffer.findNewest((char*)virSrc + offset);
+				const pso_buff_elem *destElem = buffer.findNewest((char*)virDest + offset);
+				if (srcElem == NULL)
 				{
 					// Source buffer is empty, read from local memory
 					gv.IntVal = APInt(32, *(((char*)natSrc) + offset));
@@ -1980,23 +2084,19 @@ void Interpreter::visitMemcpy(ExecutionContext &SF, CallSite CS) {
 				else
 				{
 					// Source buffer is not empty, read from it.
-					gv = thread_buffer_pso[currThread][GenericValue((char*)virSrc + offset)].back();
-					storeType = pso_types[GenericValue((char*)virSrc + offset)];
+					gv = srcElem->value;
+					storeType = srcElem->type;
 				}
 
-				// Now, how about the dest buffer?
-				if (thread_buffer_pso[currThread][GenericValue((char*)virDest + offset)].empty())
-				{
-					// Empty, no constraints!
-					pso_types[GenericValue(((char*)virDest + offset))] = (Type*)storeType;
-				}
-				else
+				// Now, how about the dest buffer? If it is empty there are no constraints.
+				if (destElem != NULL)
 				{
 					// message in the assert added
-					ASSERT(pso_types[GenericValue(((char*)virDest + offset))] == storeType, "Execution.cpp: visitMemCpy");
+					ASSERT(destElem->type == storeType, "Execution.cpp: visitMemCpy");
 				}
 				// type check passed, we can add the value...
-				thread_buffer_pso[currThread][GenericValue(((char*)virDest + offset))].push_back(gv);
+				buffer.push_back((char*)virDest + offset, gv, (Type*)storeType,
+						SF.Caller.getInstruction()->label_instr);
 				ASSERT(getTargetData()->getTypeStoreSize(storeType) == 4, "Unalgined type is on the buffer!");
 	
 				// not sure whether we need this or not
@@ -2108,7 +2208,7 @@ void Interpreter::visitRand(ExecutionContext &SF) {
 	if (Instruction* I = SF.Caller.getInstruction() ) {
 		GenericValue Result;
 		Result.IntVal = APInt::getNullValue(32);
-		Result.IntVal = Result.IntVal + rand();
+		Result.IntVal = Result.IntVal + rand_r(&randState);
 		SetValue(I, Result, SF);
 	}
 	SF.Caller = CallSite();
@@ -2164,6 +2264,7 @@ void Interpreter::visitMmap(ExecutionContext &SF) {
 	//ASSERT((size_t)natPtr%128==0, "Address returned by mmap not aligned on 128");
 	void *virPtr;
 	if(natPtr != NULL) {
+		mappedBlocks[natPtr] = length;
 		virPtr = (void *)nextVirtualAddress;
 		nextVirtualAddress += length;
 		nextVirtualAddress += MEMDIFF;
@@ -2177,6 +2278,8 @@ void Interpreter::visitMmap(ExecutionContext &SF) {
 	}
 #else
 	void *virPtr = mmap(address, length, protect, flags, filedes, offset);
+	if (virPtr != MAP_FAILED)
+		mappedBlocks[virPtr] = length;
 	bytesAtPhysicalAddress[virPtr] = length;
 #endif
 	if (Instruction *I = SF.Caller.getInstruction()) {
@@ -2205,16 +2308,18 @@ void Interpreter::visitMunmap(ExecutionContext &SF) {
 	V = *ait;
 	arg = getOperandValue(V,SF);
 	size_t length = (size_t)arg.IntVal.getLimitedValue();
-	int ret = munmap(natAddress, length);
-	bytesAtVirtualAddress[virAddress] = 0;
+	int ret = isCheckpointBlock(natAddress) ? 0 : munmap(natAddress, length);
+	mappedBlocks.erase(natAddress);
+	bytesAtVirtualAddress.erase(virAddress);
 #else
 	void *addr = arg.PointerVal;
 	++ait;
 	V = *ait;
 	arg = getOperandValue(V, SF);
 	size_t length = (size_t)arg.IntVal.getLimitedValue();
-	int ret = munmap(addr, length);
-	bytesAtPhysicalAddress[addr] = 0;
+	int ret = isCheckpointBlock(addr) ? 0 : munmap(addr, length);
+	mappedBlocks.erase(addr);
+	bytesAtPhysicalAddress.erase(addr);
 #endif
 	if(Instruction *I = SF.Caller.getInstruction()) {
 		GenericValue Result;
@@ -2358,166 +2463,241 @@ void Interpreter::visitKeySetSpecific(ExecutionContext &SF) {
 void Interpreter::visitCallSite(CallSite CS) {
 
 	ExecutionContext &SF = ECStack->back();
-	Function *F = CS.getCalledFunction();
 	SF.Caller = CS;
-	
-	if (F->getName().str() == "spawn_thread")
-		visitSpawnThread(SF);
-	else if (F->getName().str() == "assert")
-		visitAssert(SF);
-	else if (F->getName().str() == "assert_exist") 
-		visitAssertExist(SF);
-	else if (F->getName().str() == "join_all")
-		visitJoinAll(SF);
-	else if (F->getName().str() == "cas32") 
-		visitCAS(SF, CAS32);
-	else if (F->getName().str() == "casio") 
-		visitCAS(SF, CASIO);
-	else if (F->getName().str() == "caspo") 
-		visitCASPO(SF);
-	else if (F->getName().str() == "fasio") 
-		visitFASIO(SF);
-	else if (F->getName().str() == "faspo")  
-		visitFASPO(SF);
-	else if (F->getName().str() == "membar_sl") {
-		membar_sl(currThread);
-		SF.Caller = CallSite();
-	}
-	else if (F->getName().str() == "membar_ss") {
-		membar_ss(currThread);
-		SF.Caller = CallSite();
-	}
-	else if (F->getName().str() == "malloc")
-		visitMalloc(SF);
-	else if (F->getName().str() == "free")
-		visitFree(SF);
-	else if (F->getName().str() == "memset")
-		visitMemset(SF);
-	else if (F->getName().str() == "memcpy32")
-		visitMemcpy(SF, CS);
-	else if (F->getName().str() == "nprint_string") 
-		visitNprintString(SF);
-	else if (F->getName().str() == "nprint_int") 
-		visitNprintInt(SF);
-	else if (F->getName().str() == "getenv") 
-		visitGetEnv(SF);
-	else if (F->getName().str() == "rand") 
-		visitRand(SF);
-	else if (F->getName().str() == "sysconf") 
-		visitSysConf(SF);
-	else if (F->getName().str() == "mmap") 
-		visitMmap(SF);
-	else if (F->getName().str() == "munmap") 
-		visitMunmap(SF);
-	else if (F->getName().str() == "pthread_self") 
-		visitPthreadSelf(SF);
-	else if (F->getName().str() == "key_create") 
-		visitKeyCreate(SF);
-	else if (F->getName().str() == "key_getspecific") 
-		visitKeyGetSpecific(SF);
-	else if (F->getName().str() == "key_setspecific") 
-		visitKeySetSpecific(SF);
-	else {
+	SF.CallerResult = CurDecoded->Result;
+
+	// Find the descriptor of the callee.  Direct calls, possibly through a
+	// pointer cast, resolve it once and keep it in the decoded call site.  An
+	// indirect call keeps the callee it called last, and looks it up again only
+	// when the target changes.
+	FunctionInfo *Callee = CurDecoded->Callee;
+	unsigned CalleeSlot = CurDecoded->Operands[0];
+	if (CalleeSlot != DecodedInst::NoSlot) {
+		Function *Target = (Function*)GVTOP(SF.Values[CalleeSlot]);
+		if (Callee == 0 || Callee->F != Target)
+			Callee = CurDecoded->Callee = getFunctionInfo(Target);
+	} else if (Callee == 0) {
+		if (Function *DirectF = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts()))
+			Callee = CurDecoded->Callee = getFunctionInfo(DirectF);
+		else
+			Callee = getFunctionInfo((Function*)GVTOP(getDecodedOperand(0, SF)));
+	}
+	Function *F = Callee->F;
+
+	switch (Callee->Builtin) {
+		case NotBuiltin:
+			break;
+		case BuiltinSpawnThread:
+			instr_info.isSynchronizing = true;
+			visitSpawnThread(SF);
+			return;
+		case BuiltinAssert:
+			visitAssert(SF);
+			return;
+		case BuiltinAssertExist:
+			visitAssertExist(SF);
+			return;
+		case BuiltinJoinAll:
+			visitJoinAll(SF);
+			return;
+		case BuiltinCAS32:
+			instr_info.isAtomic = true;
+			visitCAS(SF, CAS32);
+			return;
+		case BuiltinCASIO:
+			instr_info.isAtomic = true;
+			visitCAS(SF, CASIO);
+			return;
+		case BuiltinCASPO:
+			instr_info.isAtomic = true;
+			visitCASPO(SF);
+			return;
+		case BuiltinFASIO:
+			instr_info.isAtomic = true;
+			visitFASIO(SF);
+			return;
+		case BuiltinFASPO:
+			instr_info.isAtomic = true;
+			visitFASPO(SF);
+			return;
+		case BuiltinMembarSL:
+			instr_info.isSynchronizing = true;
+			membar_sl(currThread);
+			SF.Caller = CallSite();
+			return;
+		case BuiltinMembarSS:
+			instr_info.isSynchronizing = true;
+			membar_ss(currThread);
+			SF.Caller = CallSite();
+			return;
+		case BuiltinMalloc:
+			visitMalloc(SF);
+			return;
+		case BuiltinFree:
+			visitFree(SF);
+			return;
+		case BuiltinMemset:
+			instr_info.isAtomic = true;
+			visitMemset(SF);
+			return;
+		case BuiltinMemcpy32:
+			instr_info.isAtomic = true;
+			visitMemcpy(SF, CS);
+			return;
+		case BuiltinNPrintString:
+			visitNprintString(SF);
+			return;
+		case BuiltinNPrintInt:
+			visitNprintInt(SF);
+			return;
+		case BuiltinGetEnv:
+			visitGetEnv(SF);
+			return;
+		case BuiltinRand:
+			visitRand(SF);
+			return;
+		case BuiltinSysConf:
+			visitSysConf(SF);
+			return;
+		case BuiltinMmap:
+			visitMmap(SF);
+			return;
+		case BuiltinMunmap:
+			visitMunmap(SF);
+			return;
+		case BuiltinPthreadSelf:
+			visitPthreadSelf(SF);
+			return;
+		case BuiltinKeyCreate:
+			visitKeyCreate(SF);
+			return;
+		case BuiltinKeyGetSpecific:
+			visitKeyGetSpecific(SF);
+			return;
+		case BuiltinKeySetSpecific:
+			visitKeySetSpecific(SF);
+			return;
+	}
+
+	// Only the calls of recorded methods need their arguments in the history
+	if (Callee->Recorded)
 		getInvokeHistoryData(SF);
-		history->RecordInvokeEvent((Function*)GVTOP(getOperandValue(SF.Caller.getCalledValue(), SF)), currThread);
-	
-		if (F && F->isDeclaration()) { 
-			switch (F->getIntrinsicID()) {
-				case Intrinsic::not_intrinsic:
-					break;
-				case Intrinsic::vastart:   // va_start	
+	history->RecordInvokeEvent(F, Callee->Recorded, currThread);
+
+	if (F->isDeclaration()) {
+		switch (F->getIntrinsicID()) {
+			case Intrinsic::not_intrinsic:
+				break;
+			case Intrinsic::vastart:   // va_start	
+			{
+				GenericValue ArgIndex;
+				ArgIndex.UIntPairVal.first = ECStack->size() - 1;
+				ArgIndex.UIntPairVal.second = 0;
+				SetValue(CS.getInstruction(), ArgIndex, SF);
+				return;
+			}
+			case Intrinsic::vaend:    // va_end is a noop for the interpreter
+				return;
+			case Intrinsic::vacopy:   // va_copy: dest = src
+				SetValue(CS.getInstruction(), getOperandValue(*CS.arg_begin(), SF), SF);
+				return;
+			default:
+				// If it is an unknown intrinsic function, use the intrinsic lowering
+				// class to transform it into hopefully tasty LLVM code.
+				//
+				Instruction *Lowered = CS.getInstruction();
+				BasicBlock::iterator me(Lowered);
+				BasicBlock *Parent = Lowered->getParent();
+				bool atBegin(Parent->begin() == me);
+				if (!atBegin)
+					--me;
+				IL->LowerIntrinsicCall(cast<CallInst>(Lowered));
+
+				// Restore the CurInst pointer to the first instruction newly inserted, if any
+				if (atBegin)
 				{
-					GenericValue ArgIndex;
-					ArgIndex.UIntPairVal.first = ECStack->size() - 1;
-					ArgIndex.UIntPairVal.second = 0;
-					SetValue(CS.getInstruction(), ArgIndex, SF);
-					return;
+					me = Parent->begin();
 				}
-				case Intrinsic::vaend:    // va_end is a noop for the interpreter
-					return;
-				case Intrinsic::vacopy:   // va_copy: dest = src
-					SetValue(CS.getInstruction(), getOperandValue(*CS.arg_begin(), SF), SF);
-					return;
-				default:
-					// If it is an unknown intrinsic function, use the intrinsic lowering
-					// class to transform it into hopefully tasty LLVM code.
-					//
-					BasicBlock::iterator me(CS.getInstruction());
-					BasicBlock *Parent = CS.getInstruction()->getParent();
-					bool atBegin(Parent->begin() == me);
-					if (!atBegin)
-						--me;
-					IL->LowerIntrinsicCall(cast<CallInst>(CS.getInstruction()));
-	
-					// Restore the CurInst pointer to the first instruction newly inserted, if any
-					if (atBegin)
-					{
-						SF.CurInst = Parent->begin();
-					}
-					else
-					{
-						SF.CurInst = me;
-						++SF.CurInst;
-					}
-					return;
-			}
-		}
-	
-		std::vector<GenericValue> ArgVals;
-		const unsigned NumArgs = SF.Caller.arg_size();
-		ArgVals.reserve(NumArgs);
-		uint16_t pNum = 1;
-		for (CallSite::arg_iterator i = SF.Caller.arg_begin(), e = SF.Caller.arg_end(); i != e; ++i, ++pNum) {
-			Value *V = *i;
-			ArgVals.push_back(getOperandValue(V, SF));
+				else
+				{
+					++me;
+				}
+				// The block changed under the decoded stream: decode the function again
+				redecodeFunction(SF.CurFunction, Lowered, me);
+				return;
 		}
-	
-		// To handle indirect calls, we must get the pointer value from the argument and treat it as a function pointer.
-		GenericValue SRC = getOperandValue(SF.Caller.getCalledValue(), SF);
-		callFunction((Function*)GVTOP(SRC), ArgVals);
 	}
+
+	// The arguments are operands of the call: read them from their slots.
+	CallArgs.clear();
+	unsigned OpNo = CS.arg_begin() - CS.getInstruction()->op_begin();
+	for (unsigned i = 0, e = CS.arg_size(); i != e; ++i)
+		CallArgs.push_back(getDecodedOperand(OpNo + i, SF));
+
+	callFunction(Callee, CallArgs);
 }
 
 void Interpreter::visitShl(BinaryOperator &I)
 {
 	ExecutionContext &SF = ECStack->back();
-	GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
-	GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
+	GenericValue Src1 = getDecodedOperand(0, SF);
+	GenericValue Src2 = getDecodedOperand(1, SF);
 	GenericValue Dest;
-	if (Src2.IntVal.getZExtValue() < Src1.IntVal.getBitWidth())
+	uint64_t Res;
+	if (unsigned Width = getNarrowWidth(I.getType()))
+	{
+		executeNarrowBinary(I.getOpcode(), Width, Src1.IntVal.getZExtValue(),
+				Src2.IntVal.getZExtValue(), Res);
+		Dest.IntVal = APInt(Width, Res);
+	}
+	else if (Src2.IntVal.getZExtValue() < Src1.IntVal.getBitWidth())
 		Dest.IntVal = Src1.IntVal.shl(Src2.IntVal.getZExtValue());
 	else
 		Dest.IntVal = Src1.IntVal;
 
-	SetValue(&I, Dest, SF);
+	setDecodedResult(Dest, SF);
 }
 
 void Interpreter::visitLShr(BinaryOperator &I)
 {
 	ExecutionContext &SF = ECStack->back();
-	GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
-	GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
+	GenericValue Src1 = getDecodedOperand(0, SF);
+	GenericValue Src2 = getDecodedOperand(1, SF);
 	GenericValue Dest;
-	if (Src2.IntVal.getZExtValue() < Src1.IntVal.getBitWidth())
+	uint64_t Res;
+	if (unsigned Width = getNarrowWidth(I.getType()))
+	{
+		executeNarrowBinary(I.getOpcode(), Width, Src1.IntVal.getZExtValue(),
+				Src2.IntVal.getZExtValue(), Res);
+		Dest.IntVal = APInt(Width, Res);
+	}
+	else if (Src2.IntVal.getZExtValue() < Src1.IntVal.getBitWidth())
 		Dest.IntVal = Src1.IntVal.lshr(Src2.IntVal.getZExtValue());
 	else
 		Dest.IntVal = Src1.IntVal;
 
-	SetValue(&I, Dest, SF);
+	setDecodedResult(Dest, SF);
 }
 
 void Interpreter::visitAShr(BinaryOperator &I)
 {
 	ExecutionContext &SF = ECStack->back();
-	GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
-	GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
+	GenericValue Src1 = getDecodedOperand(0, SF);
+	GenericValue Src2 = getDecodedOperand(1, SF);
 	GenericValue Dest;
-	if (Src2.IntVal.getZExtValue() < Src1.IntVal.getBitWidth())
+	uint64_t Res;
+	if (unsigned Width = getNarrowWidth(I.getType()))
+	{
+		executeNarrowBinary(I.getOpcode(), Width, Src1.IntVal.getZExtValue(),
+				Src2.IntVal.getZExtValue(), Res);
+		Dest.IntVal = APInt(Width, Res);
+	}
+	else if (Src2.IntVal.getZExtValue() < Src1.IntVal.getBitWidth())
 		Dest.IntVal = Src1.IntVal.ashr(Src2.IntVal.getZExtValue());
 	else
 		Dest.IntVal = Src1.IntVal;
 
-	SetValue(&I, Dest, SF);
+	setDecodedResult(Dest, SF);
 }
 
 GenericValue Interpreter::executeTruncInst(Value *SrcVal, const Type *DstTy,
@@ -2705,19 +2885,44 @@ GenericValue Interpreter::executeBitCastInst(Value *SrcVal, const Type *DstTy,
 void Interpreter::visitTruncInst(TruncInst &I)
 {
 	ExecutionContext &SF = ECStack->back();
-	SetValue(&I, executeTruncInst(I.getOperand(0), I.getType(), SF), SF);
+	if (getNarrowWidth(I.getOperand(0)->getType()))
+	{
+		// APInt keeps the low bits of the word
+		GenericValue Dest;
+		Dest.IntVal = APInt(getNarrowWidth(I.getType()),
+				getDecodedOperand(0, SF).IntVal.getZExtValue());
+		setDecodedResult(Dest, SF);
+	}
+	else
+		SetValue(&I, executeTruncInst(I.getOperand(0), I.getType(), SF), SF);
 }
 
 void Interpreter::visitSExtInst(SExtInst &I)
 {
 	ExecutionContext &SF = ECStack->back();
-	SetValue(&I, executeSExtInst(I.getOperand(0), I.getType(), SF), SF);
+	if (unsigned Width = getNarrowWidth(I.getType()))
+	{
+		GenericValue Dest;
+		Dest.IntVal = APInt(Width, (uint64_t)signExtendNarrow(
+				getDecodedOperand(0, SF).IntVal.getZExtValue(),
+				getNarrowWidth(I.getOperand(0)->getType())));
+		setDecodedResult(Dest, SF);
+	}
+	else
+		SetValue(&I, executeSExtInst(I.getOperand(0), I.getType(), SF), SF);
 }
 
 void Interpreter::visitZExtInst(ZExtInst &I)
 {
 	ExecutionContext &SF = ECStack->back();
-	SetValue(&I, executeZExtInst(I.getOperand(0), I.getType(), SF), SF);
+	if (unsigned Width = getNarrowWidth(I.getType()))
+	{
+		GenericValue Dest;
+		Dest.IntVal = APInt(Width, getDecodedOperand(0, SF).IntVal.getZExtValue());
+		setDecodedResult(Dest, SF);
+	}
+	else
+		SetValue(&I, executeZExtInst(I.getOperand(0), I.getType(), SF), SF);
 }
 
 void Interpreter::visitFPTruncInst(FPTruncInst &I)
@@ -2925,21 +3130,24 @@ GenericValue Interpreter::getConstantExprValue (ConstantExpr *CE,
 
 GenericValue Interpreter::getOperandValue(Value *V, ExecutionContext &SF)
 {
-	if (ConstantExpr *CE = dyn_cast<ConstantExpr>(V))
+	if (Constant *CPV = dyn_cast<Constant>(V))
 	{
-		return getConstantExprValue(CE, SF);
-	}
-	else if (Constant *CPV = dyn_cast<Constant>(V))
-	{
-		return getConstantValue(CPV);
-	}
-	else if (GlobalValue *GV = dyn_cast<GlobalValue>(V))
-	{
-		return PTOGV(getPointerToGlobal(GV));
+		// Constants, including globals and constant expressions on them, are
+		// folded once and then read from the constant pool.
+		DenseMap<const Constant *, GenericValue>::iterator I = ConstantPool.find(CPV);
+		if (I != ConstantPool.end())
+			return I->second;
+		GenericValue Val;
+		if (ConstantExpr *CE = dyn_cast<ConstantExpr>(CPV))
+			Val = getConstantExprValue(CE, SF);
+		else
+			Val = getConstantValue(CPV);
+		ConstantPool[CPV] = Val;
+		return Val;
 	}
 	else
 	{
-		return SF.Values[V];
+		return SF.getValue(V);
 	}
 }
 
@@ -2953,18 +3161,27 @@ GenericValue Interpreter::getOperandValue(Value *V, ExecutionContext &SF)
 void Interpreter::callFunction(Function *F,
 		const std::vector<GenericValue> &ArgVals)
 {
+	callFunction(getFunctionInfo(F), ArgVals);
+}
+
+// callFunction - As above, for a caller that has the descriptor of the callee
+// already, e.g. from the decoded call site.
+void Interpreter::callFunction(FunctionInfo *FI,
+		const std::vector<GenericValue> &ArgVals)
+{
+	Function *F = FI->F;
 	ASSERT((ECStack->empty() || ECStack->back().Caller.getInstruction() == 0 ||
 				ECStack->back().Caller.arg_size() == ArgVals.size()),
 			"Incorrect number of arguments passed into function call!");
 	// Make a new stack frame... and fill it in.
-	ECStack->push_back(ExecutionContext());
-	ExecutionContext &StackFrame = ECStack->back();
-	StackFrame.CurFunction = F;
+	ExecutionContext &StackFrame = ECStack->push(F, FI);
+	if (ECStack->size() == 1)
+		setThreadEnabled(ECStack->Owner, true);
 
 	// Special handling for external functions.
 	if (F->isDeclaration())
 	{
-		GenericValue Result = callExternalFunction (F, ArgVals);
+		GenericValue Result = callExternalFunction (StackFrame.FuncInfo, ArgVals);
 		// Simulate a 'ret' instruction of the appropriate type.
 		popStackAndReturnValueToCaller (F->getReturnType (), Result);
 		return;
@@ -2972,32 +3189,114 @@ void Interpreter::callFunction(Function *F,
 
 	// Get pointers to first LLVM BB & Instruction in function.
 	StackFrame.CurBB     = F->begin();
-	StackFrame.CurInst   = StackFrame.CurBB->begin();
+	StackFrame.CurInst   = &StackFrame.FuncInfo->Code[0];
 
 	// Run through the function arguments and initialize their values...
 	ASSERT((ArgVals.size() == F->arg_size() ||
 				(ArgVals.size() > F->arg_size() && F->getFunctionType()->isVarArg())),
 			"Invalid number of values passed to function invocation!");
 
-	// Handle non-varargs arguments...
+	// Handle non-varargs arguments... Arguments occupy the first slots.
 	unsigned i = 0;
-	for (Function::arg_iterator AI = F->arg_begin(), E = F->arg_end();
-			AI != E; ++AI, ++i)
-		SetValue(AI, ArgVals[i], StackFrame);
+	for (unsigned e = F->arg_size(); i != e; ++i)
+		StackFrame.Values[i] = ArgVals[i];
 
 	// Handle varargs arguments...
 	StackFrame.VarArgs.assign(ArgVals.begin()+i, ArgVals.end());
 }
 
-vector<Thread> Interpreter::getAllActiveThreads() const {
-	vector<Thread> enabled;
-	std::map<Thread, std::vector<ExecutionContext> >::const_iterator it;
-	for (it = threadStacks.begin(); it != threadStacks.end(); ++it) {
-		if (!it->second.empty()) {
-			enabled.push_back(it->first);
+void Interpreter::setThreadEnabled(Thread t, bool enabled) {
+	vector<Thread>::iterator it =
+		std::lower_bound(enabledThreads.begin(), enabledThreads.end(), t);
+	if (enabled)
+		enabledThreads.insert(it, t);
+	else
+		enabledThreads.erase(it);
+	updateRunnableThreads();
+}
+
+// A thread that read one of its locations from memory this many times, with
+// none of them written and no store of its own in between, spins.
+static const unsigned SpinThreshold = 8;
+// A loop that reads more locations than this is not taken for a spin.
+static const unsigned MaxSpinLocations = 4;
+
+bool Interpreter::isSpinning(Thread t) const {
+	const SpinState *state = spinStates.find(t);
+	return state != NULL && state->Repeats >= SpinThreshold;
+}
+
+void Interpreter::updateRunnableThreads() {
+	runnableThreads.clear();
+	for (unsigned i = 0; i < enabledThreads.size(); ++i) {
+		const char *waits = joinWaiting.find(enabledThreads[i]);
+		if ((waits == NULL || !*waits) && !isSpinning(enabledThreads[i]))
+			runnableThreads.push_back(enabledThreads[i]);
+	}
+	if (runnableThreads.empty()) {
+		// every thread that can go on spins
+		for (unsigned i = 0; i < enabledThreads.size(); ++i) {
+			const char *waits = joinWaiting.find(enabledThreads[i]);
+			if (waits == NULL || !*waits)
+				runnableThreads.push_back(enabledThreads[i]);
 		}
 	}
-	return enabled;
+	if (runnableThreads.empty()) {
+		// only threads in join_all are left: the one that is alone gets
+		// through
+		runnableThreads = enabledThreads;
+	}
+}
+
+void Interpreter::setJoinWaiting(Thread t, bool waiting) {
+	char &waits = joinWaiting[t];
+	if (waits != waiting) {
+		waits = waiting;
+		updateRunnableThreads();
+	}
+}
+
+// noteSharedRead - The current thread read a shared location.
+void Interpreter::noteSharedRead(void *addr) {
+	SpinState &state = spinStates[currThread];
+	if (std::find(state.Addrs.begin(), state.Addrs.end(), addr) != state.Addrs.end()) {
+		if (++state.Repeats == SpinThreshold)
+			updateRunnableThreads();
+		return;
+	}
+	if (state.Addrs.size() == MaxSpinLocations)
+		noteProgress();
+	state.Addrs.push_back(addr);
+}
+
+// noteProgress - The current thread made progress: it stored, to a shared
+// location or its stack, or wrote atomically.  A spin only reads.
+void Interpreter::noteProgress() {
+	SpinState &state = spinStates[currThread];
+	bool spun = state.Repeats >= SpinThreshold;
+	state.Addrs.clear();
+	state.Repeats = 0;
+	if (spun)
+		updateRunnableThreads();
+}
+
+// noteMemoryWrite - size bytes at addr changed in memory, where every thread
+// can see them: the threads that read them start over.
+void Interpreter::noteMemoryWrite(void *addr, unsigned size) {
+	bool woken = false;
+	for (unsigned t = 0; t < spinStates.size(); ++t) {
+		SpinState &state = spinStates[Thread(t)];
+		for (unsigned i = 0; i < state.Addrs.size(); ++i) {
+			if (state.Addrs[i] >= addr && (char*)state.Addrs[i] < (char*)addr + size) {
+				woken = woken || state.Repeats >= SpinThreshold;
+				state.Addrs.clear();
+				state.Repeats = 0;
+				break;
+			}
+		}
+	}
+	if (woken)
+		updateRunnableThreads();
 }
 
 
@@ -3015,14 +3314,12 @@ void Interpreter::flushAll() {
 	}
 	else if (Params::WMM == WMM_PSO) {
 		vector<Thread> enabled = getAllActiveThreads();
-		std::map<GenericValue, std::list<GenericValue> >::iterator mit;
-		std::vector<GenericValue> possibleAddress;
 		for (unsigned i = 0; i < enabled.size(); i++) {
-			for(mit = thread_buffer_pso[enabled[i]].begin(); 
-				mit != thread_buffer_pso[enabled[i]].end(); ++mit) {
-				if (!mit->second.empty()) {
-					flush_buffer_pso(enabled[i], mit->first);
-				}
+			// one store per buffered address; going downwards visits every
+			// address once even though emptied queues leave the list
+			PSOBuffer &buffer = thread_buffer_pso[enabled[i]];
+			for (unsigned j = buffer.getNumAddresses(); j-- > 0; ) {
+				flush_buffer_pso(enabled[i], GenericValue(buffer.getAddress(j)));
 			}
 			rw_history->RecordRWEvent(enabled[i], FLUSH_INSTR, 0);
 		}
@@ -3031,10 +3328,69 @@ void Interpreter::flushAll() {
 
 Constraints constraintsHandler;
 
+// overBudget - Whether the trace ran out of TRACESTEPS or TRACETIME.  The
+// clock is read only every few thousand instructions.
+bool Interpreter::overBudget(const timeval &start) const {
+	if (Params::traceSteps > 0 && traceSteps >= Params::traceSteps)
+		return true;
+	if (Params::traceTime > 0 && traceSteps % 4096 == 0) {
+		timeval now;
+		gettimeofday(&now, 0);
+		return now.tv_sec - start.tv_sec +
+			(now.tv_usec - start.tv_usec) / 1000000.0 >= Params::traceTime;
+	}
+	return false;
+}
+
+// reportLivelock - Print the instructions the last RecentWindow instructions
+// of the trace ran most, with their threads: the loop the trace is stuck in.
+void Interpreter::reportLivelock() const {
+	std::map<std::pair<const Instruction*, int>, unsigned> counts;
+	unsigned n = std::min<unsigned long>(traceSteps, RecentWindow);
+	for (unsigned i = 0; i < n; ++i)
+		++counts[std::make_pair(recentInsts[i], recentThreads[i])];
+	std::vector<std::pair<unsigned, std::pair<const Instruction*, int> > > ranked;
+	for (std::map<std::pair<const Instruction*, int>, unsigned>::const_iterator
+			it = counts.begin(); it != counts.end(); ++it)
+		ranked.push_back(std::make_pair(it->second, it->first));
+	std::sort(ranked.rbegin(), ranked.rend());
+
+	cout << "LIVELOCK: the trace ran out of its budget after " << traceSteps
+		<< " instructions; looping on:" << endl;
+	for (unsigned i = 0; i < ranked.size() && i < 8; ++i) {
+		// only lli-synth labels the instructions
+		const Instruction *I = ranked[i].second.first;
+		cout << "  label " << I->label_instr << " (" << I->getOpcodeName() << " in "
+			<< I->getParent()->getParent()->getNameStr() << "/"
+			<< I->getParent()->getNameStr() << "), thread "
+			<< ranked[i].second.second << ", " << ranked[i].first << " times" << endl;
+	}
+}
+
+// failPartialTrace - The trace, stopped before the program ended, violated
+// the specification: lli-synth turns what it ran into constraints, lli exits.
+void Interpreter::failPartialTrace() {
+	rw_history->FindSharedRW();
+	ExitStatus = 253;
+	if (toFix == true) { // lli-synth mode
+		constraints->Calculate(rw_history, nextThreadNum);
+		if (constraints->GetLitSingleNumber() == 0) {
+			rw_history->PrintSharedRW();
+			exit(255);
+		}
+	} else { // lli mode
+		history->printRecordedTrace();
+		rw_history->PrintSharedRW();
+		exit(253);
+	}
+}
+
 // the function where it all happens
 void Interpreter::run() {
 	cout << "PROGRAM OUTPUT" << endl;
-	Scheduler scheduler;
+	Scheduler scheduler(Seed, RunNumber);
+	timeval start;
+	gettimeofday(&start, 0);
 	while (1) {
 		if (getAllActiveThreads().size() == 0) {
 			flushAll();
@@ -3045,9 +3401,19 @@ void Interpreter::run() {
 				break;
 			}
 
+			if (checker != 0 && toFix == true && runMain == true) {
+				// checked on another thread while the next trace runs
+				checker->submit(history, rw_history, nextThreadNum);
+				break;
+			}
+
 			clock_t start2 = clock(); // for time measurement
 			rw_history->FindSharedRW();
 			//rw_history->PrintSharedRW();
+			if (Params::Scheduler == PREDICTIVE)
+				TracePredictor::get().analyze(rw_history->shared_rec);
+			if (toFix == true && Params::coverage) // lli-synth mode
+				constraints->Cover(rw_history, nextThreadNum);
 			ExitStatus = CheckTrace::checkHistory(history, nextThreadNum);
 
 			/* checking fails, then we build constrains from rw_history, to a data structure. */
@@ -3055,11 +3421,11 @@ void Interpreter::run() {
 				rw_history->PrintSharedRW();
 				if (toFix == true) { // lli-synth mode
 					//rw_history->PrintSharedRW();
-					constraintsHandler.Calculate(rw_history, nextThreadNum);
+					constraints->Calculate(rw_history, nextThreadNum);
 
-					timeofChecking += clock() - start2;
+					checkingTime += clock() - start2;
  
-         				if (constraintsHandler.GetLitSingleNumber() == 0) {
+         				if (constraints->GetLitSingleNumber() == 0) {
 						rw_history->PrintSharedRW();
 						exit(255);
 					}
@@ -3076,29 +3442,37 @@ void Interpreter::run() {
 			currThread = action.thread;
 			ECStack = &threadStacks[currThread];
 			ExecutionContext &SF = ECStack->back();  // Current stack frame
-			Instruction &I = *SF.CurInst++;
+			CurDecoded = SF.CurInst++;
 			NumDynamicInsts += 1;
 
 			/* initialize the information of I */
 			instr_info.isBlocked = false;
 			instr_info.isSharedAccessing = false;
+			instr_info.isSynchronizing = false;
+			instr_info.isAtomic = false;
+			instr_info.label = CurDecoded->Inst->label_instr;
+			recentInsts[traceSteps % RecentWindow] = CurDecoded->Inst;
+			recentThreads[traceSteps % RecentWindow] = currThread.tid();
+			++traceSteps;
 
-			visit(I);   // Dispatch to one of the visit* methods...
+			CurDecoded->Handler(*this, *CurDecoded->Inst);   // Dispatch to one of the visit* methods...
 
 			if (segmentFaultFlag == true && runMain == true) {
 				cout << "ERROR: Segmentation Fault!!! Exit!" << endl;
-				rw_history->FindSharedRW();
-				ExitStatus = 253; 
-				if (toFix == true) { // lli-synth mode
-					constraintsHandler.Calculate(rw_history, nextThreadNum);
-          				if (constraintsHandler.GetLitSingleNumber() == 0) {
-						rw_history->PrintSharedRW();
-						exit(255);
-					}
-				} else { // lli mode
-					history->printRecordedTrace();	
-					rw_history->PrintSharedRW();
-					exit(253);
+				failPartialTrace();
+				break;
+			}
+
+			if (runMain == true && overBudget(start)) {
+				// most likely a retry loop that an unfair schedule never lets
+				// succeed; a trace that already failed an assert is a violation
+				reportLivelock();
+				if (assertFailed) {
+					failPartialTrace();
+				} else {
+					ExitStatus = 252;
+					if (toFix == false) // lli mode
+						exit(252);
 				}
 				break;
 			}
@@ -3106,12 +3480,14 @@ void Interpreter::run() {
 		} else if (action.type == FLUSH_BUFFER) {
 			if (Params::WMM == WMM_TSO) {
 				flush_buffer_tso(action.thread);
-				// randomly, only one element is flushed
-				rw_history->RecordRWEvent(currThread, FLUSH_RANDOM_TSO, -1); 
+				// randomly, only one element is flushed.  It is recorded under
+				// the flushed thread, not the one that ran last: Constraints
+				// replays the buffer of a thread from that thread's events.
+				rw_history->RecordRWEvent(action.thread, FLUSH_RANDOM_TSO, -1);
 			}
 			else if (Params::WMM == WMM_PSO) {
 				flush_buffer_pso(action.thread, action.pso_var);
-				rw_history->RecordRWEvent(action.pso_var, currThread, FLUSH_RANDOM_PSO, -1); 
+				rw_history->RecordRWEvent(action.pso_var, action.thread, FLUSH_RANDOM_PSO, -1);
 			}
 		}
 	}
@@ -48,8 +48,6 @@ using namespace llvm;
 
 static ManagedStatic<sys::Mutex> FunctionsLock;
 
-typedef GenericValue (*ExFunc)(const FunctionType *,
-                               const std::vector<GenericValue> &);
 static ManagedStatic<std::map<const Function *, ExFunc> > ExportedFunctions;
 static std::map<std::string, ExFunc> FuncNames;
 
@@ -58,7 +56,9 @@ typedef void (*RawFunc)();
 static ManagedStatic<std::map<const Function *, RawFunc> > RawFunctions;
 #endif
 
-static Interpreter *TheInterpreter;
+// The interpreter calling the external function; lli-synth -threads runs
+// several, one per thread.
+static __thread Interpreter *TheInterpreter;
 
 static char getTypeID(const Type *Ty) {
   switch (Ty->getTypeID()) {
@@ -244,17 +244,24 @@ static bool ffiInvoke(RawFunc Fn, Function *F,
 }
 #endif // USE_LIBFFI
 
-GenericValue Interpreter::callExternalFunction(Function *F,
+GenericValue Interpreter::callExternalFunction(FunctionInfo *Info,
                                      const std::vector<GenericValue> &ArgVals) {
   TheInterpreter = this;
+  Function *F = Info->F;
+
+  // The lle_* implementation is looked up once and kept in the descriptor.
+  if (Info->External)
+    return Info->External(F->getFunctionType(), ArgVals);
 
   FunctionsLock->acquire();
 
-  // Do a lookup to see if the function is in our cache... this should just be a
-  // deferred annotation!
-  std::map<const Function *, ExFunc>::iterator FI = ExportedFunctions->find(F);
-  if (ExFunc Fn = (FI == ExportedFunctions->end()) ? lookupFunction(F)
-                                                   : FI->second) {
+  if (!Info->ExternalResolved) {
+    std::map<const Function *, ExFunc>::iterator FI = ExportedFunctions->find(F);
+    Info->External = (FI == ExportedFunctions->end()) ? lookupFunction(F)
+                                                      : FI->second;
+    Info->ExternalResolved = true;
+  }
+  if (ExFunc Fn = Info->External) {
     FunctionsLock->release();
     return Fn(F->getFunctionType(), ArgVals);
   }
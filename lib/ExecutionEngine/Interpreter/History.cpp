@@ -27,6 +27,14 @@ History::History()
 	recur_calls.push_back(0);
 }
 
+void History::clear()
+{
+	trace_rec.clear();
+	recur_calls.assign(2, 0);
+	paramTypes.clear();
+	intVals.clear();
+}
+
 void History::RecordFirstEvent()
 {
 	if (Params::recTrace()) {
@@ -34,10 +42,10 @@ void History::RecordFirstEvent()
 	}
 }
 
-void History::RecordInvokeEvent(Function* currFunction, Thread currThread)
+void History::RecordInvokeEvent(Function* currFunction, bool Recorded, Thread currThread)
 {
 	if (Params::recTrace()) {
-		if (Params::funcs_rec.find(currFunction->getName().str()) != Params::funcs_rec.end() && recur_calls[currThread.tid()] == 0) {
+		if (Recorded && recur_calls[currThread.tid()] == 0) {
 			trace_elem elem;
 			elem.type = CALL_FUNC;
 			elem.func = currFunction;
@@ -57,18 +65,18 @@ void History::RecordInvokeEvent(Function* currFunction, Thread currThread)
 			}
 			trace_rec.push_back(elem);
 		}
-		if (Params::funcs_rec.find(currFunction->getName().str()) != Params::funcs_rec.end()) {
+		if (Recorded) {
 			recur_calls[currThread.tid()]++;
 		}
 	}
 }
 
-void History::RecordReturnEvent(const Type*& RetTy, GenericValue& Result, Function*& currFunction, Thread& currThread)
+void History::RecordReturnEvent(const Type*& RetTy, GenericValue& Result, Function*& currFunction, bool Recorded, Thread& currThread)
 {
   if (Params::recTrace()) {
 	trace_elem elem;
 
-	if (Params::funcs_rec.find(currFunction->getName().str()) != Params::funcs_rec.end() && recur_calls[currThread.tid()] == 1) {
+	if (Recorded && recur_calls[currThread.tid()] == 1) {
 		elem.type = RETURN_FUNC;
 		if (RetTy->isPointerTy() && Result.PointerVal != NULL) {
 			elem.ret_val = (size_t)Result.PointerVal;
@@ -84,7 +92,7 @@ void History::RecordReturnEvent(const Type*& RetTy, GenericValue& Result, Functi
 		elem.thread = currThread;
 		trace_rec.push_back(elem);
 	}
-	if (Params::funcs_rec.find(currFunction->getName().str()) != Params::funcs_rec.end()) {
+	if (Recorded) {
 		recur_calls[currThread.tid()]--;
 	}
   }
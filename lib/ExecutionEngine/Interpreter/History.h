@@ -52,10 +52,13 @@ class History {
 	public:
 	 History();
 	 void RecordFirstEvent();
-	 void RecordInvokeEvent(Function*, Thread);
-	 void RecordReturnEvent(const Type*&, GenericValue&, Function*&, Thread&);
+	 // Recorded tells whether the function is one of Params::funcs_rec
+	 void RecordInvokeEvent(Function*, bool Recorded, Thread);
+	 void RecordReturnEvent(const Type*&, GenericValue&, Function*&, bool Recorded, Thread&);
    void printRecordedTrace();
 	 void freeRecordedTrace();
+	 // clear - Forget the trace, for the next run of the program.
+	 void clear();
 };
 }
 #endif
@@ -16,6 +16,8 @@
 #include "Interpreter.h"
 #include "llvm/CodeGen/IntrinsicLowering.h"
 #include "llvm/DerivedTypes.h"
+#include "llvm/Instructions.h"
+#include "llvm/Intrinsics.h"
 #include "llvm/Module.h"
 #include "llvm/ExecutionEngine/Thread.h"
 #include "llvm/Instruction.h"
@@ -26,6 +28,9 @@
 #include "llvm/Support/FormattedStream.h"
 #include "Params.h"
 #include "History.h"
+#include "Scheduler.h"
+#include "Constraints.h"
+#include "llvm/System/Atomic.h"
 #include <cstring>
 #include <string>
 #include <sstream>
@@ -37,6 +42,7 @@
 #include <cstdio>
 #include <ctime>
 #include <sys/time.h>
+#include <sys/mman.h>
 using namespace llvm;
 
 namespace {
@@ -49,6 +55,9 @@ namespace {
 
 extern "C" void LLVMLinkInInterpreter() { }
 
+// where the interpreters of lli-synth put their reorderings by default
+extern Constraints constraintsHandler;
+
 /// create - Create a new interpreter object.  This can never fail.
 ///
 ExecutionEngine *Interpreter::create(Module *M, std::string* ErrStr) {
@@ -77,15 +86,8 @@ Interpreter::Interpreter(Module *M)
 		Params::processInputFile();
 		history = new History();
 		rw_history = new RWHistory();
-		currThread = Thread::getThreadByNumber(1);
-		nextThreadNum = 2;
-		ECStack = &threadStacks[currThread];
-		counter = 0;
-		int seed = time(0);
-		timeval tv;
-		gettimeofday(&tv,0);
-		seed = tv.tv_usec;
-		srand(seed);
+		constraints = &constraintsHandler;
+		checker = 0;
 #if defined(VIRTUALMEMORY)
 		virtualizeGlobalVariables();
 #else 
@@ -93,17 +95,488 @@ Interpreter::Interpreter(Module *M)
 #endif
 		Mod = M;
 		IL = new IntrinsicLowering(TD);
+		CurDecoded = 0;
+		snapshotMemory();
+		beginTrace();
+}
+
+// snapshotMemory - Remember the initial memory of the program for reset().
+void Interpreter::snapshotMemory() {
+	for (Module::global_iterator GV = Mod->global_begin(), E = Mod->global_end();
+			GV != E; ++GV) {
+		if (GV->isDeclaration())
+			continue;
+		char *Addr = (char *)getPointerToGlobal(GV);
+#if defined(VIRTUALMEMORY)
+		Addr = (char *)getNativeAddressGlobal(Addr);
+#endif
+		size_t Size = TD.getTypeAllocSize(GV->getType()->getElementType());
+		if (Size == 0)
+			continue;
+		globalImage.push_back(std::make_pair(Addr, std::vector<char>(Addr, Addr + Size)));
+	}
+#if defined(VIRTUALMEMORY)
+	initialNativeToVirtual = nativeToVirtual;
+	initialVirtualToNative = virtualToNative;
+	initialBytesAtVirtualAddress = bytesAtVirtualAddress;
+	initialNextVirtualAddress = nextVirtualAddress;
+#else
+	initialBytesAtPhysicalAddress = bytesAtPhysicalAddress;
+#endif
+}
+
+// the runs of the program in this process so far
+static volatile sys::cas_flag NumRuns = 0;
+
+void Interpreter::skipRuns(unsigned n) {
+	sys::AtomicAdd(&NumRuns, n);
+}
+
+// beginTrace - The state a run of the program starts in.
+void Interpreter::beginTrace() {
+		currThread = Thread::getThreadByNumber(1);
+		nextThreadNum = 2;
+		ECStack = &threadStacks[currThread];
+		ECStack->Owner = currThread;
+		counter = 0;
+		// every run of the process gets its own seed; see Scheduler::getSeed
+		RunNumber = sys::AtomicIncrement(&NumRuns);
+		Seed = Scheduler::getSeed(RunNumber);
+		cout << "Seed: " << Seed << endl;
+		randState = Seed;
 
 		/* initialized last instr info */
 		instr_info.isBlocked = false;
+		instr_info.isSharedAccessing = false;
+		instr_info.isSynchronizing = false;
+		instr_info.isAtomic = false;
+		instr_info.label = 0;
+		ExitStatus = 0;
+		segmentFaultFlag = false;
+		allonAssertExist = false;
+		traceSteps = 0;
+		assertFailed = false;
+		checkingTime = 0;
+}
+
+void Interpreter::reset() {
+	// the stacks keep the address space of their allocas
+	for (unsigned t = 0; t < threadStacks.size(); ++t)
+		threadStacks[Thread(t)].clear();
+	enabledThreads.clear();
+	runnableThreads.clear();
+	joinWaiting.clear();
+	spinStates.clear();
+	threadKeys.clear();
+	thread_buffer_tso.clear();
+	thread_buffer_pso.clear();
+	history->clear();
+	rw_history->clear();
+	AtExitHandlers.clear();
+	memset(&ExitValue.Untyped, 0, sizeof(ExitValue.Untyped));
+
+	releaseHeap();
+	for (unsigned i = 0; i < globalImage.size(); ++i)
+		memcpy(globalImage[i].first, &globalImage[i].second[0], globalImage[i].second.size());
+#if defined(VIRTUALMEMORY)
+	nativeToVirtual = initialNativeToVirtual;
+	virtualToNative = initialVirtualToNative;
+	bytesAtVirtualAddress = initialBytesAtVirtualAddress;
+	nextVirtualAddress = initialNextVirtualAddress;
+#else
+	bytesAtPhysicalAddress = initialBytesAtPhysicalAddress;
+#endif
+	beginTrace();
+}
+
+// releaseHeap - Give back the memory the program allocated, but for the
+// objects the checkpoint keeps.
+void Interpreter::releaseHeap() {
+	for (std::set<void*>::iterator I = mallocBlocks.begin(), E = mallocBlocks.end();
+			I != E; ++I)
+		if (!isCheckpointBlock(*I))
+			free(*I);
+	mallocBlocks.clear();
+	for (std::map<void*, size_t>::iterator I = mappedBlocks.begin(),
+			E = mappedBlocks.end(); I != E; ++I)
+		if (!isCheckpointBlock(I->first))
+			munmap(I->first, I->second);
+	mappedBlocks.clear();
+}
+
+bool Interpreter::awaitsCheckpoint() const {
+	// a log recorded from a checkpoint would not replay from the start
+	return Params::checkpoint && runMain && !checkpoint.Valid &&
+		nextThreadNum == 2 && Params::Scheduler != DPOR &&
+		Params::Scheduler != BOUNDED && !Scheduler::usesLog();
+}
+
+// takeCheckpoint - Remember the state of the trace for the later runs of
+// main.  Called when the first thread has been spawned.
+void Interpreter::takeCheckpoint() {
+	Checkpoint &C = checkpoint;
+	C.Entry = threadStacks[Thread::getThreadByNumber(1)][0].CurFunction;
+	C.Stacks.resize(threadStacks.size());
+	for (unsigned t = 0; t < threadStacks.size(); ++t)
+		threadStacks[Thread(t)].save(C.Stacks[t]);
+	C.Globals.resize(globalImage.size());
+	for (unsigned i = 0; i < globalImage.size(); ++i) {
+		char *Addr = globalImage[i].first;
+		C.Globals[i].assign(Addr, Addr + globalImage[i].second.size());
+	}
+	C.MallocBlocks = mallocBlocks;
+	C.MappedBlocks = mappedBlocks;
+	for (std::set<void*>::iterator I = mallocBlocks.begin(), E = mallocBlocks.end();
+			I != E; ++I) {
+		char *Addr = (char *)*I;
+#if defined(VIRTUALMEMORY)
+		size_t Size = bytesAtVirtualAddress[nativeToVirtual[Addr]];
+#else
+		size_t Size = bytesAtPhysicalAddress[Addr];
+#endif
+		C.Heap.push_back(std::make_pair(Addr, std::vector<char>(Addr, Addr + Size)));
+	}
+	for (std::map<void*, size_t>::iterator I = mappedBlocks.begin(),
+			E = mappedBlocks.end(); I != E; ++I) {
+		char *Addr = (char *)I->first;
+		C.Heap.push_back(std::make_pair(Addr, std::vector<char>(Addr, Addr + I->second)));
+	}
+#if defined(VIRTUALMEMORY)
+	C.NativeToVirtual = nativeToVirtual;
+	C.VirtualToNative = virtualToNative;
+	C.BytesAtVirtualAddress = bytesAtVirtualAddress;
+	C.NextVirtualAddress = nextVirtualAddress;
+#else
+	C.BytesAtPhysicalAddress = bytesAtPhysicalAddress;
+#endif
+	C.TSOBuffers = thread_buffer_tso;
+	C.PSOBuffers = thread_buffer_pso;
+	C.Hist = *history;
+	C.SharedRec = rw_history->shared_rec;
+	C.RWTraceRec = rw_history->rwtrace_rec;
+	C.ThreadKeys = threadKeys;
+	C.AtExitHandlers = AtExitHandlers;
+	C.NextThreadNum = nextThreadNum;
+	C.CurrThread = currThread;
+	C.TraceSteps = traceSteps;
+	C.Valid = true;
+	cout << "CHECKPOINT: the next traces start after the first " << traceSteps
+		<< " instructions" << endl;
+}
+
+// restoreCheckpoint - Put the interpreter back into the state takeCheckpoint
+// saw.  The memory of the globals and of the objects allocated before it gets
+// its contents back, whatever the traces since did to it.
+void Interpreter::restoreCheckpoint() {
+	Checkpoint &C = checkpoint;
+	// e.g. what the static constructors of this run allocated
+	releaseHeap();
+	for (unsigned i = 0; i < globalImage.size(); ++i)
+		memcpy(globalImage[i].first, &C.Globals[i][0], C.Globals[i].size());
+	for (unsigned i = 0; i < C.Heap.size(); ++i)
+		if (!C.Heap[i].second.empty())
+			memcpy(C.Heap[i].first, &C.Heap[i].second[0], C.Heap[i].second.size());
+	mallocBlocks = C.MallocBlocks;
+	mappedBlocks = C.MappedBlocks;
+#if defined(VIRTUALMEMORY)
+	nativeToVirtual = C.NativeToVirtual;
+	virtualToNative = C.VirtualToNative;
+	bytesAtVirtualAddress = C.BytesAtVirtualAddress;
+	nextVirtualAddress = C.NextVirtualAddress;
+#else
+	bytesAtPhysicalAddress = C.BytesAtPhysicalAddress;
+#endif
+
+	for (unsigned t = 1; t < C.Stacks.size(); ++t) {
+		Thread T = Thread::getThreadByNumber(t);
+		ExecutionStack &Stack = threadStacks[T];
+		Stack.Owner = T;
+		Stack.restore(C.Stacks[t]);
+		if (!Stack.empty())
+			setThreadEnabled(T, true);
+	}
+	thread_buffer_tso = C.TSOBuffers;
+	thread_buffer_pso = C.PSOBuffers;
+	*history = C.Hist;
+	rw_history->shared_rec = C.SharedRec;
+	rw_history->rwtrace_rec = C.RWTraceRec;
+	threadKeys = C.ThreadKeys;
+	AtExitHandlers = C.AtExitHandlers;
+	nextThreadNum = C.NextThreadNum;
+	currThread = C.CurrThread;
+	ECStack = &threadStacks[currThread];
+	traceSteps = C.TraceSteps;
 }
 
 Interpreter::~Interpreter() {
+	for (DenseMap<const Function *, FunctionInfo *>::iterator I = FunctionInfos.begin(),
+			E = FunctionInfos.end(); I != E; ++I)
+		delete I->second;
+	for (unsigned t = 0; t < threadStacks.size(); ++t)
+		threadStacks[Thread(t)].releaseAllocas();
+	releaseHeap();
+	for (std::set<void*>::iterator I = checkpoint.MallocBlocks.begin(),
+			E = checkpoint.MallocBlocks.end(); I != E; ++I)
+		free(*I);
+	for (std::map<void*, size_t>::iterator I = checkpoint.MappedBlocks.begin(),
+			E = checkpoint.MappedBlocks.end(); I != E; ++I)
+		munmap(I->first, I->second);
 	delete IL;
 	delete history;
 	delete rw_history;
 }
 
+//===----------------------------------------------------------------------===//
+// Instruction decoding
+//
+
+// One handler per opcode, built from Instruction.def the same way as the
+// switch in InstVisitor::visit().
+#define HANDLE_INST(NUM, OPCODE, CLASS) \
+	static void handle##OPCODE(Interpreter &Interp, Instruction &I) { \
+		Interp.visit##OPCODE(static_cast<CLASS&>(I)); \
+	}
+#include "llvm/Instruction.def"
+
+// Memory model policies.  Loads and stores are bound to the variant of the
+// memory model in conf.txt when a function is decoded, so executing them
+// never consults Params::WMM.  These handlers are the only way to a load or
+// store; the Interpreter has no visitLoadInst/visitStoreInst of its own.
+struct NoWmmPolicy {
+	static void load(Interpreter &Interp, LoadInst &I) { Interp.visitLoadInstNoWmm(I); }
+	static void store(Interpreter &Interp, StoreInst &I) { Interp.visitStoreInstNoWmm(I); }
+};
+struct TSOPolicy {
+	static void load(Interpreter &Interp, LoadInst &I) { Interp.visitLoadInstTSO(I); }
+	static void store(Interpreter &Interp, StoreInst &I) { Interp.visitStoreInstTSO(I); }
+};
+struct PSOPolicy {
+	static void load(Interpreter &Interp, LoadInst &I) { Interp.visitLoadInstPSO(I); }
+	static void store(Interpreter &Interp, StoreInst &I) { Interp.visitStoreInstPSO(I); }
+};
+
+template<class Policy>
+static void handleLoadWith(Interpreter &Interp, Instruction &I) {
+	Interp.instr_info.isWriteOrRead = true; // this is a read instruction
+	Policy::load(Interp, static_cast<LoadInst&>(I));
+}
+
+template<class Policy>
+static void handleStoreWith(Interpreter &Interp, Instruction &I) {
+	Interp.instr_info.isWriteOrRead = false; // this is a write instruction
+	Policy::store(Interp, static_cast<StoreInst&>(I));
+}
+
+template<class Policy>
+static InstHandler getMemoryHandler(unsigned Opcode) {
+	return Opcode == Instruction::Load ? handleLoadWith<Policy> : handleStoreWith<Policy>;
+}
+
+static InstHandler getInstHandler(unsigned Opcode) {
+	if (Opcode == Instruction::Load || Opcode == Instruction::Store) {
+		switch (Params::WMM) {
+			case WMM_NONE: return getMemoryHandler<NoWmmPolicy>(Opcode);
+			case WMM_TSO:  return getMemoryHandler<TSOPolicy>(Opcode);
+			case WMM_PSO:  return getMemoryHandler<PSOPolicy>(Opcode);
+			default: ASSERT(false, "Unknown memory model");
+		}
+	}
+	switch (Opcode) {
+#define HANDLE_INST(NUM, OPCODE, CLASS) \
+		case Instruction::OPCODE: return handle##OPCODE;
+#include "llvm/Instruction.def"
+		default: llvm_unreachable("Unknown instruction type encountered!");
+	}
+}
+
+// getBuiltinKind - Which DFENCE builtin, if any, a function of this name is.
+static BuiltinKind getBuiltinKind(StringRef Name) {
+	static const struct {
+		const char *Name;
+		BuiltinKind Kind;
+	} Builtins[] = {
+		{ "spawn_thread", BuiltinSpawnThread },
+		{ "assert", BuiltinAssert },
+		{ "assert_exist", BuiltinAssertExist },
+		{ "join_all", BuiltinJoinAll },
+		{ "cas32", BuiltinCAS32 },
+		{ "casio", BuiltinCASIO },
+		{ "caspo", BuiltinCASPO },
+		{ "fasio", BuiltinFASIO },
+		{ "faspo", BuiltinFASPO },
+		{ "membar_sl", BuiltinMembarSL },
+		{ "membar_ss", BuiltinMembarSS },
+		{ "malloc", BuiltinMalloc },
+		{ "free", BuiltinFree },
+		{ "memset", BuiltinMemset },
+		{ "memcpy32", BuiltinMemcpy32 },
+		{ "nprint_string", BuiltinNPrintString },
+		{ "nprint_int", BuiltinNPrintInt },
+		{ "getenv", BuiltinGetEnv },
+		{ "rand", BuiltinRand },
+		{ "sysconf", BuiltinSysConf },
+		{ "mmap", BuiltinMmap },
+		{ "munmap", BuiltinMunmap },
+		{ "pthread_self", BuiltinPthreadSelf },
+		{ "key_create", BuiltinKeyCreate },
+		{ "key_getspecific", BuiltinKeyGetSpecific },
+		{ "key_setspecific", BuiltinKeySetSpecific }
+	};
+	for (unsigned i = 0; i != sizeof(Builtins) / sizeof(Builtins[0]); ++i)
+		if (Name == Builtins[i].Name)
+			return Builtins[i].Kind;
+	return NotBuiltin;
+}
+
+// FunctionInfo ctor - Describe how calls of F are made, number the arguments
+// of F, then decode its body, which numbers the instructions in program order.
+FunctionInfo::FunctionInfo(Function *F)
+	: F(F), Builtin(getBuiltinKind(F->getName())),
+	  Recorded(Params::funcs_rec.count(F->getName().str()) != 0),
+	  ExternalResolved(false), External(0), NumSlots(0) {
+	for (Function::arg_iterator AI = F->arg_begin(), E = F->arg_end(); AI != E; ++AI)
+		Slots[AI] = NumSlots++;
+	decode(F);
+}
+
+void FunctionInfo::decode(Function *F) {
+	Code.clear();
+	OperandSlots.clear();
+	Blocks.clear();
+	CodeIndex.clear();
+
+	// Where the operand slots of each entry of Code start in OperandSlots.
+	std::vector<unsigned> FirstOperand;
+
+	for (Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB) {
+		DecodedBlock &DB = Blocks[BB];
+		BasicBlock::iterator I = BB->begin(), IE = BB->end();
+
+		// PHI nodes become one copy list per incoming edge.
+		for (; PHINode *PN = dyn_cast<PHINode>(I); ++I) {
+			unsigned Dest = getSlot(PN);
+			if (DB.Edges.empty())
+				for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i)
+					if (PN->getBasicBlockIndex(PN->getIncomingBlock(i)) == (int)i)
+						DB.Edges.push_back(std::make_pair(PN->getIncomingBlock(i),
+									std::vector<PHICopy>()));
+			for (unsigned i = 0, e = DB.Edges.size(); i != e; ++i) {
+				int Idx = PN->getBasicBlockIndex(DB.Edges[i].first);
+				ASSERT(Idx != -1, "PHINode doesn't contain entry for predecessor??");
+				PHICopy Copy;
+				Copy.Dest = Dest;
+				Copy.SrcVal = PN->getIncomingValue(Idx);
+				Copy.Src = (isa<Instruction>(Copy.SrcVal) || isa<Argument>(Copy.SrcVal))
+					? getSlot(Copy.SrcVal) : DecodedInst::NoSlot;
+				DB.Edges[i].second.push_back(Copy);
+			}
+		}
+
+		DB.Start = Code.size();
+		for (; I != IE; ++I) {
+			DecodedInst D;
+			D.Inst = I;
+			D.Handler = getInstHandler(I->getOpcode());
+			D.Result = I->getType()->isVoidTy() ? DecodedInst::NoSlot : getSlot(I);
+			D.Operands = 0;
+			D.Callee = 0;
+			FirstOperand.push_back(OperandSlots.size());
+			for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+				Value *Op = I->getOperand(i);
+				OperandSlots.push_back((isa<Instruction>(Op) || isa<Argument>(Op))
+						? getSlot(Op) : DecodedInst::NoSlot);
+			}
+			Code.push_back(D);
+		}
+	}
+
+	// OperandSlots does not move any more.
+	for (unsigned i = 0, e = Code.size(); i != e; ++i)
+		if (FirstOperand[i] < OperandSlots.size())
+			Code[i].Operands = &OperandSlots[FirstOperand[i]];
+}
+
+DecodedInst *FunctionInfo::getDecoded(Instruction *I) {
+	if (CodeIndex.empty())
+		for (unsigned i = 0, e = Code.size(); i != e; ++i)
+			CodeIndex[Code[i].Inst] = i;
+	DenseMap<const Instruction *, unsigned>::iterator It = CodeIndex.find(I);
+	ASSERT(It != CodeIndex.end(), "instruction is not in the decoded stream");
+	return &Code[It->second];
+}
+
+FunctionInfo *Interpreter::getFunctionInfo(Function *F) {
+	FunctionInfo *&FI = FunctionInfos[F];
+	if (FI == 0)
+		FI = new FunctionInfo(F);
+	return FI;
+}
+
+// redecodeFunction - Called after the intrinsic call Lowered in F has been
+// replaced by ordinary instructions.  Decode F again and move every frame
+// running F onto the new stream; a frame that was about to execute Lowered
+// continues at Next instead.  So does the running frame: run() has moved its
+// CurInst past Lowered already, before dispatching it.
+void Interpreter::redecodeFunction(Function *F, Instruction *Lowered,
+		Instruction *Next) {
+	FunctionInfo *FI = getFunctionInfo(F);
+	ExecutionContext *Running = 0;
+	if (CurDecoded && CurDecoded->Inst == Lowered)
+		Running = &ECStack->back();
+	std::vector<std::pair<ExecutionContext *, Instruction *> > Frames;
+	for (unsigned t = 0; t < threadStacks.size(); ++t) {
+		ExecutionStack &Stack = threadStacks[Thread(t)];
+		for (unsigned i = 0; i < Stack.size(); ++i) {
+			ExecutionContext &Frame = Stack[i];
+			if (Frame.FuncInfo != FI)
+				continue;
+			Instruction *At = &Frame == Running ? Lowered : Frame.CurInst->Inst;
+			Frames.push_back(std::make_pair(&Frame, At == Lowered ? Next : At));
+		}
+	}
+	// the frames the checkpoint keeps run in the old stream as well
+	for (unsigned t = 0; t < checkpoint.Stacks.size(); ++t) {
+		std::vector<ExecutionContext> &Saved = checkpoint.Stacks[t].Frames;
+		for (unsigned i = 0; i < Saved.size(); ++i) {
+			if (Saved[i].FuncInfo != FI)
+				continue;
+			Instruction *At = Saved[i].CurInst->Inst;
+			Frames.push_back(std::make_pair(&Saved[i], At == Lowered ? Next : At));
+		}
+	}
+	FI->decode(F);
+	for (unsigned i = 0; i < Frames.size(); ++i) {
+		Frames[i].first->CurInst = FI->getDecoded(Frames[i].second);
+		Frames[i].first->Values.resize(FI->NumSlots);
+	}
+	// the old stream is gone
+	CurDecoded = 0;
+}
+
+void Interpreter::lowerIntrinsics() {
+	std::vector<CallInst *> Calls;
+	for (Module::iterator F = Mod->begin(), FE = Mod->end(); F != FE; ++F)
+		for (Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB)
+			for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+				CallInst *CI = dyn_cast<CallInst>(I);
+				Function *Callee = CI ? CI->getCalledFunction() : 0;
+				if (Callee == 0 || !Callee->isDeclaration())
+					continue;
+				switch (Callee->getIntrinsicID()) {
+					// what visitCallSite runs itself
+					case Intrinsic::not_intrinsic:
+					case Intrinsic::vastart:
+					case Intrinsic::vaend:
+					case Intrinsic::vacopy:
+						break;
+					default:
+						Calls.push_back(CI);
+				}
+			}
+	for (unsigned i = 0; i < Calls.size(); ++i)
+		IL->LowerIntrinsicCall(Calls[i]);
+}
+
 void Interpreter::runAtExitHandlers () {
 	while (!AtExitHandlers.empty()) {
 		callFunction(AtExitHandlers.back(), std::vector<GenericValue>());
@@ -152,8 +625,12 @@ Interpreter::runFunction(Function *F,
 		ActualArgs.push_back(ArgValues[i]);
   }
 
-	// Set up the function call.
-	callFunction(F, ActualArgs);
+	// Set up the function call, or go on from where the first spawn_thread of
+	// an earlier run left main.
+	if (runMain && checkpoint.Valid && F == checkpoint.Entry)
+		restoreCheckpoint();
+	else
+		callFunction(F, ActualArgs);
 
 	// Start executing the function.
 	run();
@@ -164,7 +641,9 @@ Interpreter::runFunction(Function *F,
 // createThread creates a new thread in the map and loads the initial function
 void Interpreter::createThread(GenericValue functionToCall) {
 	// first create the thread itself
-	ECStack = &threadStacks[Thread::getThreadByNumber(nextThreadNum)];
+	Thread newThread = Thread::getThreadByNumber(nextThreadNum);
+	ECStack = &threadStacks[newThread];
+	ECStack->Owner = newThread;
 	++nextThreadNum;
 
 	// now iterate through function to see which is the desired one
@@ -205,26 +684,26 @@ void Interpreter::dumpState(Instruction& I) {
 	errs() << "\n";
 	errs() << "L I V I N G  T H R E A D S\n";
 	errs() << "--------------------------\n";
-	std::map<Thread, std::vector<ExecutionContext> >::iterator mit;
-	for(mit=threadStacks.begin();mit!=threadStacks.end();++mit) {
-		if(!mit->second.empty()) errs() << mit->first.tid() << " ";
+	for(unsigned t=0;t<enabledThreads.size();++t) {
+		errs() << enabledThreads[t].tid() << " ";
 		errs() << "\n";
 	}
 	errs() << "The thread to execute next is: " << currThread.tid() << "\n";
 	errs() << "The next instruction to interpret is: " << I << "\n";
 
-	for(mit=threadStacks.begin();mit!=threadStacks.end();++mit) { 
-    if(!mit->second.empty()) {
-			errs() << "Stack frame for thread: " << mit->first.tid() 
-             << " at depth " << mit->second.size() << "\n";
+	for(unsigned t=0;t<enabledThreads.size();++t) { 
+    ExecutionStack &Stack = threadStacks[enabledThreads[t]];
+    {
+			errs() << "Stack frame for thread: " << enabledThreads[t].tid() 
+             << " at depth " << Stack.size() << "\n";
 		  errs() << "------------------------" << "-------" << "----------" 
              << "---------------" << "\n";
 
-		  std::map<Value *,GenericValue>::iterator lit;
-		  ExecutionContext &SF = mit->second.back();
+		  DenseMap<const Value *, unsigned>::iterator lit;
+		  ExecutionContext &SF = Stack.back();
 		  GenericValue GV;
-		  for(lit=SF.Values.begin();lit!=SF.Values.end();++lit) {
-			  GV = getOperandValue(lit->first,SF);
+		  for(lit=SF.FuncInfo->Slots.begin();lit!=SF.FuncInfo->Slots.end();++lit) {
+			  GV = SF.Values[lit->second];
 			  if(lit->first->getType()->isPointerTy()) {
 				  errs() << "Name: " << lit->first->getName().str() << " Type: " 
                  << lit->first->getType()->getDescription() << " Value: " 
@@ -242,32 +721,43 @@ void Interpreter::dumpState(Instruction& I) {
 }
 
 bool Interpreter::isAddressOnStack(void* mem, ExecutionContext& SF) {
-	int i,j;
-	size_t A,B,C;
-	C = (size_t)mem;
-	for(j=0;j<threadStacks[currThread].size();++j) {
-		for(i=0;i<threadStacks[currThread][j].Allocas.size();++i) {
-			A = (size_t)threadStacks[currThread][j].Allocas[i];
-			B = threadStacks[currThread][j].Allocas.getBytesAt((void*)A);
-			B = A+B;
-			if(A <= C && C < B) return true;
-		}
-	}
-	return false;
-}
-
-void Interpreter::freeAllocas(ExecutionContext& SF) {
-	int i;
-	for(i=0;i<SF.Allocas.size();++i) {
 #if defined(VIRTUALMEMORY)
-		void *virAddr = SF.Allocas.getAddress(i);
-		void *natAddr = virtualToNative[virAddr];
-		free(natAddr);
+	return getNativeAddressStack(mem) != NULL;
 #else
-		void *addr = SF.Allocas.getAddress(i);
-		free(addr);
+	return threadStacks[currThread].isAllocaAddress(mem);
 #endif
-	}
+}
+
+void ExecutionStack::reserveAllocas() {
+	// The pages are only committed when the interpreted program touches them.
+	void *Mem = mmap(0, AllocaStackSize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	ASSERT(Mem != MAP_FAILED, "cannot reserve the alloca stack of a thread");
+	AllocaBase = AllocaTop = (char *)Mem;
+	AllocaLimit = AllocaBase + AllocaStackSize;
+	for (unsigned i = 0; i < Depth; ++i)
+		Frames[i].AllocaMark = AllocaBase;
+}
+
+void ExecutionStack::save(Image &I) const {
+	I.Frames.assign(Frames.begin(), Frames.begin() + Depth);
+	I.Allocas.assign(AllocaBase, AllocaTop);
+}
+
+void ExecutionStack::restore(const Image &I) {
+	Depth = I.Frames.size();
+	if (Frames.size() < Depth)
+		Frames.resize(Depth);
+	std::copy(I.Frames.begin(), I.Frames.end(), Frames.begin());
+	if (!I.Allocas.empty())
+		memcpy(AllocaBase, &I.Allocas[0], I.Allocas.size());
+	AllocaTop = AllocaBase + I.Allocas.size();
+}
+
+void ExecutionStack::releaseAllocas() {
+	if (AllocaBase != 0)
+		munmap(AllocaBase, AllocaStackSize);
+	AllocaBase = AllocaTop = AllocaLimit = 0;
 }
 
 
@@ -280,13 +770,7 @@ bool Interpreter::isThreadBufferNonEmpty(Thread t) {
 			return false;
 	}
 	else if (Params::WMM == WMM_PSO) {
-			std::map<GenericValue, std::list<GenericValue> >::iterator mit;
-			for(mit = thread_buffer_pso[t].begin(); mit != thread_buffer_pso[t].end(); ++mit) {
-				if(!mit->second.empty()) {
-					return true;
-				}
-			}
-			return false;
+			return !thread_buffer_pso[t].empty();
 	}
 	
 	ASSERT(false, "Should be Unreachable");
@@ -297,29 +781,23 @@ bool Interpreter::isWorkingWithGlobalMemory(Instruction& I) const {
 }
 
 #if defined(VIRTUALMEMORY)
-void *Interpreter::getVirtualBaseAddressStack(void *addr, ExecutionContext& SF) {
-	int i;
-	size_t A,B,C;
-	C = (size_t)addr;
-	for(i=0;i<SF.Allocas.size();++i) {
-		A = (size_t)SF.Allocas.getAddress(i);
-		B = A + SF.Allocas.getBytesAt((void*)A);
-		if(C>=A && C<B) return SF.Allocas.getAddress(i);
-	}
-	return NULL;
+void *Interpreter::getNativeAddressStack(void *addr) {
+	ExecutionStack &Stack = threadStacks[currThread];
+	if (Stack.VirtualBase == NULL)
+		return NULL;
+	void *natAddr = (void*)( (size_t)addr - (size_t)Stack.VirtualBase + (size_t)Stack.allocaBase() );
+	return Stack.isAllocaAddress(natAddr) ? natAddr : NULL;
 }
 
 void *Interpreter::getNativeAddressFull(void *virAddr, ExecutionContext& SF) {
 	if((size_t)virAddr==0)return (void*)0;
 	void *virBase = getVirtualBaseAddressHeap(virAddr);
 	if(virBase == NULL) {
-		int i;
-		for(i=0;i<threadStacks[currThread].size();++i) {
-			if(virBase == NULL)virBase = getVirtualBaseAddressStack(virAddr,threadStacks[currThread][i]);
+		void *natAddr = getNativeAddressStack(virAddr);
+		if(natAddr == NULL) {
+			ASSERT(0, "getNativeAddressFull - memory corruption");
 		}
-	}
-	if(virBase == NULL) {
-		ASSERT(0, "getNativeAddressFull - memory corruption");
+		return natAddr;
 	}
 	size_t offset = (size_t)virAddr - (size_t)virBase;
 	void *natBase = virtualToNative[virBase];
@@ -25,9 +25,11 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/ExecutionEngine/Thread.h"
 #include "llvm/ExecutionEngine/ThreadKey.h"
+#include "llvm/ADT/DenseMap.h"
 #include "History.h"
 #include "RWHistory.h"
 #include "Action.h"
+#include "StoreBuffer.h"
 #include <string>
 #include <vector>
 #include <fstream>
@@ -40,99 +42,264 @@
 #include <set>
 #include <algorithm>
 #include <deque>
+#include <sys/time.h>
 
 #define DEBUG_PRINT
 
 #define CAS32 0
 #define CASIO 1
 
+class Constraints;
+
 namespace llvm {
 
 	class IntrinsicLowering;
+	class TraceChecker;
+	class Interpreter;
 	struct FunctionInfo;
 	template<typename T> class generic_gep_type_iterator;
 	class ConstantExpr;
 	typedef generic_gep_type_iterator<User::const_op_iterator> gep_type_iterator;
 
 
-	// AllocaHolder - Object to track all of the blocks of memory allocated by
-	// alloca.  When the function returns, this object is popped off the execution
-	// stack, which causes the dtor to be run, which frees all the alloca'd memory.
+	typedef std::vector<GenericValue> ValuePlaneTy;
+
+	// ExFunc - A native implementation (lle_*) of an external function.
+	typedef GenericValue (*ExFunc)(const FunctionType *,
+			const std::vector<GenericValue> &);
+
+	// BuiltinKind - The DFENCE builtins that visitCallSite implements itself
+	// instead of calling the function.
+	enum BuiltinKind {
+		NotBuiltin,
+		BuiltinSpawnThread, BuiltinAssert, BuiltinAssertExist, BuiltinJoinAll,
+		BuiltinCAS32, BuiltinCASIO, BuiltinCASPO, BuiltinFASIO, BuiltinFASPO,
+		BuiltinMembarSL, BuiltinMembarSS,
+		BuiltinMalloc, BuiltinFree, BuiltinMemset, BuiltinMemcpy32,
+		BuiltinNPrintString, BuiltinNPrintInt, BuiltinGetEnv, BuiltinRand,
+		BuiltinSysConf, BuiltinMmap, BuiltinMunmap, BuiltinPthreadSelf,
+		BuiltinKeyCreate, BuiltinKeyGetSpecific, BuiltinKeySetSpecific
+	};
+
+	// InstHandler - Executes one instruction.  There is one handler per opcode,
+	// which calls the matching visit method without going through visit().
+	typedef void (*InstHandler)(Interpreter &Interp, Instruction &I);
+
+	// DecodedInst - An instruction as the run loop sees it: its handler and the
+	// frame slots of its result and operands.  Values that do not live in the
+	// frame (constants, globals, blocks) have NoSlot.
 	//
-	class AllocaHolder {
-		friend class AllocaHolderHandle;
-		std::vector<void*> Allocations;
-		unsigned RefCnt;
-		public:
-		AllocaHolder() : RefCnt(0) {}
-		void add(void *mem) {
-			Allocations.push_back(mem);
-		}
-		// Change the destructor not to free memory
-		// there is no way that the AllocaHolder could know what the native addresses are
-		// so it relies that the memory is already freed by somebody else
-		// in the case it is popStackAndReturn
-		~AllocaHolder() {
-			for (unsigned i = 0; i < Allocations.size(); ++i) {
-				//free(Allocations[i]);
-			}
-		}
-		//  map to store how many bytes are allocated for every address on the stack
-		std::map<void *, int> bytesAllocated;
-		//  method to insert not only the address but and the number of bytes allocated
-		void addWithSize(void *mem, int numBytes) {
-			Allocations.push_back(mem);
-			bytesAllocated[mem] = numBytes;
-		}
+	struct DecodedInst {
+		static const unsigned NoSlot = ~0U;
+
+		Instruction    *Inst;
+		InstHandler     Handler;
+		unsigned        Result;   // slot of the result, NoSlot if void
+		const unsigned *Operands; // slot of each operand
+		FunctionInfo   *Callee;   // calls: the callee, once resolved
+	};
+
+	// PHICopy - One PHI node assignment made when control enters a block.
+	struct PHICopy {
+		unsigned Dest;    // slot of the PHI node
+		unsigned Src;     // slot of the incoming value, or NoSlot
+		Value   *SrcVal;  // the incoming value
 	};
 
-	// AllocaHolderHandle gives AllocaHolder value semantics so we can stick it into
-	// a vector...
+	// DecodedBlock - Where a basic block starts in the decoded stream, and the
+	// PHI copies to make for each of its predecessors.
 	//
-	class AllocaHolderHandle {
-		AllocaHolder *H;
-		public:
-		AllocaHolderHandle() : H(new AllocaHolder()) { H->RefCnt++; }
-		AllocaHolderHandle(const AllocaHolderHandle &AH) : H(AH.H) { H->RefCnt++; }
-		~AllocaHolderHandle() { if (--H->RefCnt == 0) delete H; }
-
-		void add(void *mem) { H->add(mem); }
-		//  method to get element by index
-		void * operator[] (int i) {
-			ASSERT( i>=0 && i < (int)H->Allocations.size(), "index for allocas is out of bounds\n");
-			return H->Allocations[i];
-		}
-		//  method to get the size of the vector
-		int size() {
-			return H->Allocations.size();
-		}
-		//  method to insert not only the address but and the number of bytes allocated
-		void addWithSize(void *mem, int numBytes) {
-			H -> addWithSize(mem,numBytes);
+	struct DecodedBlock {
+		unsigned Start;   // index of the first non-PHI instruction
+		std::vector<std::pair<BasicBlock *, std::vector<PHICopy> > > Edges;
+
+		const std::vector<PHICopy> &getPHICopies(BasicBlock *Pred) const {
+			for (unsigned i = 0, e = Edges.size(); i != e; ++i)
+				if (Edges[i].first == Pred)
+					return Edges[i].second;
+			ASSERT(0, "PHINode doesn't contain entry for predecessor??");
+			return Edges[0].second;
 		}
-		int getBytesAt(void *mem) {
-			return H -> bytesAllocated[mem];
+	};
+
+	// FunctionInfo - Computed once per Function by the interpreter.  Every
+	// argument and every instruction is numbered into a dense slot, so that a
+	// stack frame can keep its values in a flat ValuePlaneTy, and the body is
+	// decoded into the stream of DecodedInsts that Interpreter::run executes.
+	// PHI nodes are not part of the stream: entering a block performs the
+	// copies of the edge taken instead.  It also describes how a call of the
+	// function is carried out, so that calls need no name lookups.
+	//
+	struct FunctionInfo {
+		Function *F;
+		BuiltinKind Builtin;      // builtin implemented by visitCallSite, if any
+		bool Recorded;            // listed in the methods file (Params::funcs_rec)
+		bool ExternalResolved;    // External has been looked up
+		ExFunc External;          // lle_* implementation of a declaration, if any
+
+		DenseMap<const Value *, unsigned> Slots; // slot of each argument and instruction
+		unsigned NumSlots;
+		std::vector<DecodedInst> Code;           // all blocks, in layout order
+		std::vector<unsigned> OperandSlots;      // storage of DecodedInst::Operands
+		DenseMap<const BasicBlock *, DecodedBlock> Blocks;
+		DenseMap<const Instruction *, unsigned> CodeIndex; // made by getDecoded
+
+		explicit FunctionInfo(Function *F);
+
+		// decode - (Re)build the decoded stream of F.  Slots that are already
+		// numbered keep their number, so live frames stay valid.
+		void decode(Function *F);
+
+		const DecodedBlock &getBlock(BasicBlock *BB) {
+			DenseMap<const BasicBlock *, DecodedBlock>::iterator I = Blocks.find(BB);
+			ASSERT(I != Blocks.end(), "jump to a block outside the executing function");
+			return I->second;
 		}
-		void *getAddress(int i) {
-			ASSERT(i>=0 && i<(int)H->Allocations.size(), "trying to get allocation address with index out-of-bounds");
-			return H -> Allocations[i];
+		// getDecoded - The entry of I in Code.  The index is made on the first
+		// lookup after a decode, which only redecodeFunction needs.
+		DecodedInst *getDecoded(Instruction *I);
+
+		// getSlot - Return the slot of V, numbering it on first sight.  This covers
+		// instructions inserted after the pre-pass, e.g. by the intrinsic lowering.
+		unsigned getSlot(const Value *V) {
+			DenseMap<const Value *, unsigned>::iterator I = Slots.find(V);
+			if (I != Slots.end())
+				return I->second;
+			Slots[V] = NumSlots;
+			return NumSlots++;
 		}
 	};
 
-	typedef std::vector<GenericValue> ValuePlaneTy;
-
 	// ExecutionContext struct - This struct represents one stack frame currently
 	// executing.
 	//
 	struct ExecutionContext {
 		Function             *CurFunction;// The currently executing function
+		FunctionInfo         *FuncInfo;   // Slot numbering of CurFunction
 		BasicBlock           *CurBB;      // The currently executing BB
-		BasicBlock::iterator  CurInst;    // The next instruction to execute
-		std::map<Value *, GenericValue> Values; // LLVM values used in this invocation
+		DecodedInst          *CurInst;    // The next instruction to execute
+		ValuePlaneTy          Values;     // LLVM values used in this invocation, by slot
 		std::vector<GenericValue>  VarArgs; // Values passed through an ellipsis
 		CallSite             Caller;     // Holds the call that called subframes.
 		// NULL if main func or debugger invoked fn
-		AllocaHolderHandle    Allocas;    // Track memory allocated by alloca
+		unsigned             CallerResult; // slot of the result of Caller, NoSlot if void
+		char                 *AllocaMark; // Alloca stack top on entry
+
+		// getValue - Return the storage for V in this frame.
+		GenericValue &getValue(Value *V) {
+			unsigned Slot = FuncInfo->getSlot(V);
+			if (Slot >= Values.size())
+				Values.resize(FuncInfo->NumSlots);
+			return Values[Slot];
+		}
+	};
+
+	// ExecutionStack - The runtime stack of one interpreted thread.  Popped
+	// frames are not destroyed but stay above Depth as the thread's frame pool,
+	// so the next call on the thread reuses their value planes and vectors.
+	//
+	// The allocas of the thread are bump allocated from one contiguous region
+	// that is reserved on the first alloca.  A frame gives its allocas back by
+	// resetting the top when it is popped, so [AllocaBase, AllocaTop) is
+	// exactly the memory of the live allocas of the thread.
+	//
+	class ExecutionStack {
+		std::vector<ExecutionContext> Frames;
+		unsigned Depth;
+		char *AllocaBase, *AllocaTop, *AllocaLimit;
+		void reserveAllocas();
+		public:
+		Thread Owner;   // The thread this is the stack of
+		// AllocaStackSize - Address space reserved for the allocas of a thread.
+		static const size_t AllocaStackSize = 64 << 20;
+#if defined(VIRTUALMEMORY)
+		// VirtualBase - The virtual address the program sees for AllocaBase.
+		char *VirtualBase;
+		ExecutionStack() : Depth(0), AllocaBase(0), AllocaTop(0), AllocaLimit(0),
+			VirtualBase(0) {}
+#else
+		ExecutionStack() : Depth(0), AllocaBase(0), AllocaTop(0), AllocaLimit(0) {}
+#endif
+
+		bool empty() const { return Depth == 0; }
+		unsigned size() const { return Depth; }
+		ExecutionContext &back() { return Frames[Depth - 1]; }
+		ExecutionContext &operator[](unsigned i) { return Frames[i]; }
+
+		// push - Make a recycled (or new) frame the top of the stack and prepare
+		// it for a call of F.  This may invalidate references to other frames.
+		ExecutionContext &push(Function *F, FunctionInfo *FI) {
+			if (Depth == Frames.size())
+				Frames.push_back(ExecutionContext());
+			ExecutionContext &SF = Frames[Depth++];
+			SF.CurFunction = F;
+			SF.FuncInfo = FI;
+			SF.CurInst = 0;
+			SF.Values.resize(FI->NumSlots);
+			SF.VarArgs.clear();
+			SF.Caller = CallSite();
+			SF.CallerResult = DecodedInst::NoSlot;
+			SF.AllocaMark = AllocaTop;
+			return SF;
+		}
+		// pop_back - Drop the top frame and free its allocas.
+		void pop_back() { AllocaTop = Frames[--Depth].AllocaMark; }
+		void clear() { Depth = 0; AllocaTop = AllocaBase; }
+
+		// allocate - Return Bytes of memory for an alloca of the top frame.
+		void *allocate(unsigned Bytes) {
+			if (AllocaBase == 0)
+				reserveAllocas();
+			size_t Size = (Bytes + 15) & ~(size_t)15;
+			ASSERT(Size <= (size_t)(AllocaLimit - AllocaTop),
+					"interpreted thread overflowed its alloca stack");
+			char *Mem = AllocaTop;
+			AllocaTop += Size;
+			return Mem;
+		}
+		// isAllocaAddress - Whether Addr (a native address) points into a live
+		// alloca of this thread.
+		bool isAllocaAddress(const void *Addr) const {
+			const char *P = (const char *)Addr;
+			return AllocaBase <= P && P < AllocaTop;
+		}
+		char *allocaBase() const { return AllocaBase; }
+		// releaseAllocas - Give the alloca region back to the system.
+		void releaseAllocas();
+
+		// Image - The live frames of a stack and the memory of its allocas.
+		struct Image {
+			std::vector<ExecutionContext> Frames;
+			std::vector<char> Allocas;
+		};
+		// save/restore - Copy the stack out, and make a saved copy the stack
+		// again.  The allocas go back to where they were, so the pointers to
+		// them stay valid.
+		void save(Image &I) const;
+		void restore(const Image &I);
+	};
+
+	// ThreadArray - Per-thread state indexed by thread number.  Thread numbers
+	// are handed out densely from 1, so this is a plain array; it grows on
+	// first access to a thread and never moves an element that exists.
+	//
+	template<class T>
+	class ThreadArray {
+		std::deque<T> Elems;
+		public:
+		T &operator[](Thread t) {
+			if ((unsigned)t.tid() >= Elems.size())
+				Elems.resize(t.tid() + 1);
+			return Elems[t.tid()];
+		}
+		// find - The state of t, or NULL if t has none yet.
+		const T *find(Thread t) const {
+			return (unsigned)t.tid() < Elems.size() ? &Elems[t.tid()] : 0;
+		}
+		// size - One past the highest thread number with state.
+		unsigned size() const { return Elems.size(); }
+		// clear - Forget the state of every thread.
+		void clear() { Elems.clear(); }
 	};
 
 
@@ -149,23 +316,130 @@ namespace llvm {
 		//  added the star to make it pointer to the real stack, 
 		// for the current thread
 		// that way less LLVM code is changed
-		std::vector<ExecutionContext> *ECStack;
+		ExecutionStack *ECStack;
 
 		// *********************************************************************
 		// support for threads
 		//  map for stacks for every thread. ECStack point to one of these vectors
 		//  to the one that is executing the next isntruction
-		std::map< Thread, std::vector<ExecutionContext> > threadStacks;
+		ThreadArray<ExecutionStack> threadStacks;
+		//  the threads whose stacks are not empty, in thread order.  It changes
+		//  only when a thread starts or finishes, so the Scheduler reads it as is
+		std::vector<Thread> enabledThreads;
+		void setThreadEnabled(Thread t, bool enabled);
+		//  a thread that waits in join_all, or spins, is not run while another
+		//  thread can go on.  A thread spins when it keeps reading the same
+		//  few shared locations from memory, stores nothing, and none of them
+		//  is written in between
+		struct SpinState {
+			std::vector<void*> Addrs;  // the locations it read since the last change
+			unsigned Repeats;          // reads of one of them again
+			SpinState() : Repeats(0) {}
+		};
+		ThreadArray<char> joinWaiting;
+		ThreadArray<SpinState> spinStates;
+		//  the enabled threads that the RANDOM schedulers pick from
+		std::vector<Thread> runnableThreads;
+		void updateRunnableThreads();
+		void setJoinWaiting(Thread t, bool waiting);
+		void noteSharedRead(void *addr);
+		void noteProgress();
+		void noteMemoryWrite(void *addr, unsigned size);
 		//  keys of every thread
 		std::map<std::pair<Thread, char*>, ThreadKey> threadKeys;
 		//  the number of the next thread that will eventually be created
 	  int nextThreadNum;
+		//  the seed of this run and the number of the run in this process
+		unsigned Seed;
+		unsigned RunNumber;
 		//  the current thread, i.e. the thread that will execute the next operation
 		Thread currThread;
 
 		//  here, we added an object of type History
 		History* history;
 		RWHistory* rw_history;
+		//  where the reorderings of the traces go: constraintsHandler, unless
+		//  lli-synth runs several interpreters at once
+		Constraints *constraints;
+		//  where the traces of lli-synth -pipeline are checked, 0 to check them
+		//  at their end
+		TraceChecker *checker;
+		//  the state of rand() of the program, seeded with the run
+		unsigned randState;
+		//  the processor time the last trace spent checking it
+		clock_t checkingTime;
+
+		//  the instructions the trace ran, and the last of them with their
+		//  threads, to tell where a trace that ran out of its budget loops
+		enum { RecentWindow = 1024 };
+		const Instruction *recentInsts[RecentWindow];
+		int recentThreads[RecentWindow];
+		unsigned long traceSteps;
+		//  an assert of the program failed during the trace
+		bool assertFailed;
+
+		//  the memory of the globals right after they were emitted, and the
+		//  objects the heap maps knew then; reset() returns to them
+		std::vector<std::pair<char*, std::vector<char> > > globalImage;
+#if defined(VIRTUALMEMORY)
+		std::map<void*, void*> initialNativeToVirtual;
+		std::map<void*, void*> initialVirtualToNative;
+		std::map<void*, int> initialBytesAtVirtualAddress;
+		int initialNextVirtualAddress;
+#else
+		std::map<void*, int> initialBytesAtPhysicalAddress;
+#endif
+		//  the native memory the program got from malloc and mmap and did
+		//  not give back yet
+		std::set<void*> mallocBlocks;
+		std::map<void*, size_t> mappedBlocks;
+		void snapshotMemory();
+		void beginTrace();
+		void releaseHeap();
+
+		//  the state right after the first spawn_thread of a trace
+		//  (CHECKPOINT = true).  The later runs of main start from it instead
+		//  of from the beginning; the objects the program allocated before it
+		//  stay allocated for them until the interpreter is deleted
+		struct Checkpoint {
+			bool Valid;
+			Function *Entry;                       // the function the trace ran
+			std::vector<ExecutionStack::Image> Stacks;  // by thread number
+			std::vector<std::vector<char> > Globals;    // as globalImage
+			std::vector<std::pair<char*, std::vector<char> > > Heap;
+			std::set<void*> MallocBlocks;
+			std::map<void*, size_t> MappedBlocks;
+#if defined(VIRTUALMEMORY)
+			std::map<void*, void*> NativeToVirtual;
+			std::map<void*, void*> VirtualToNative;
+			std::map<void*, int> BytesAtVirtualAddress;
+			int NextVirtualAddress;
+#else
+			std::map<void*, int> BytesAtPhysicalAddress;
+#endif
+			ThreadArray<TSOBuffer> TSOBuffers;
+			ThreadArray<PSOBuffer> PSOBuffers;
+			History Hist;
+			std::vector<rwtrace_elem> SharedRec;
+			std::vector<rwtrace_elem> RWTraceRec;
+			std::map<std::pair<Thread, char*>, ThreadKey> ThreadKeys;
+			std::vector<Function*> AtExitHandlers;
+			int NextThreadNum;
+			Thread CurrThread;
+			unsigned long TraceSteps;
+			Checkpoint() : Valid(false), Entry(0) {}
+		};
+		Checkpoint checkpoint;
+		void takeCheckpoint();
+		void restoreCheckpoint();
+		//  whether the program got Addr from malloc or mmap before the checkpoint
+		bool isCheckpointBlock(void *Addr) const {
+			return checkpoint.MallocBlocks.count(Addr) ||
+				checkpoint.MappedBlocks.count(Addr);
+		}
+		bool overBudget(const timeval &start) const;
+		void reportLivelock() const;
+		void failPartialTrace();
 
 		// information for the scheduler
 		public:
@@ -177,28 +451,42 @@ namespace llvm {
 		Thread getCurrThread() const {
 			return currThread;
 		}
+		// getTraceSteps - The instructions the last trace ran.
+		unsigned long getTraceSteps() const {
+			return traceSteps;
+		}
+		// getCheckingTime - The processor time the last trace spent checking.
+		clock_t getCheckingTime() const {
+			return checkingTime;
+		}
+		Constraints *getConstraints() const {
+			return constraints;
+		}
+		void setConstraints(Constraints *C) {
+			constraints = C;
+		}
+		// setChecker - Hand the traces of main over to C rather than check
+		// them; the trace then ends with ExitStatus 0 unless it ran out of its
+		// budget.
+		void setChecker(TraceChecker *C) {
+			checker = C;
+		}
 
 		typedef struct {
 			bool isBlocked;
 			bool isWriteOrRead; // false-write; true-read
 			bool isSharedAccessing;	
+			bool isSynchronizing; // spawn_thread or a fence
+			bool isAtomic; // an atomic or memset/memcpy, not seen through addr
 			size_t addr;
 			int width;
+			int label; // label_instr of the instruction
 		} last_instr_info;
 		last_instr_info instr_info;
 
-		private:
-		typedef struct {
-		  GenericValue pointer;
-		  GenericValue value;
-		  Type* type;
-		} tso_buff_elem;
-
-		std::map<GenericValue, Type*> pso_types;
-		
 		public: // public because of class Scheduler
-		std::map<Thread, std::list<tso_buff_elem> > thread_buffer_tso;
-		std::map<Thread, std::map<GenericValue, std::list<GenericValue> > > thread_buffer_pso;
+		ThreadArray<TSOBuffer> thread_buffer_tso;
+		ThreadArray<PSOBuffer> thread_buffer_pso;
 		
 		private:
 		void flush_buffer_pso(Thread, GenericValue);
@@ -209,10 +497,74 @@ namespace llvm {
 		// registered with the atexit() library function.
 		std::vector<Function*> AtExitHandlers;
 
+		// Slot numbering of every function called so far, built on its first call.
+		DenseMap<const Function *, FunctionInfo *> FunctionInfos;
+		FunctionInfo *getFunctionInfo(Function *F);
+		// Argument values of the call being set up by visitCallSite. It is kept
+		// here so that a call does not allocate a fresh vector.
+		std::vector<GenericValue> CallArgs;
+		// The value of every constant operand read so far.  Globals do not move
+		// once they are emitted, so these values hold until the module changes.
+		DenseMap<const Constant *, GenericValue> ConstantPool;
+		// Incoming values of the PHI nodes of the block being entered.
+		std::vector<GenericValue> PHIValues;
+		// The instruction that run() is executing.
+		DecodedInst *CurDecoded;
+		void redecodeFunction(Function *F, Instruction *Lowered, Instruction *Next);
+
+		// getDecodedOperand - Value of operand OpNo of the instruction being
+		// executed, read straight from its slot when it lives in the frame.
+		GenericValue getDecodedOperand(unsigned OpNo, ExecutionContext &SF) {
+			unsigned Slot = CurDecoded->Operands[OpNo];
+			if (Slot != DecodedInst::NoSlot)
+				return SF.Values[Slot];
+			return getOperandValue(CurDecoded->Inst->getOperand(OpNo), SF);
+		}
+		// setDecodedResult - Store the result of the instruction being executed.
+		void setDecodedResult(const GenericValue &Val, ExecutionContext &SF) {
+			SF.Values[CurDecoded->Result] = Val;
+		}
+
 		public:
 		explicit Interpreter(Module *M);
 		~Interpreter();
 
+		/// reset - Make the interpreter ready to run the program again as if it
+		/// were new: the globals get their initial values back, the memory the
+		/// program allocated is freed, and the threads, store buffers and
+		/// histories are emptied.  The decoded functions and the constant pool
+		/// are kept, so the module must not have changed.
+		void reset();
+
+		/// awaitsCheckpoint - Whether the trace is to take the checkpoint at its
+		/// first spawn_thread, which it did not reach yet.  DPOR and BOUNDED
+		/// replay the decisions of a run from its start, so they always run
+		/// it whole.
+		bool awaitsCheckpoint() const;
+
+		/// lowerIntrinsics - Lower every call of an intrinsic the interpreter
+		/// does not run itself, which it does otherwise on the first call.
+		/// Interpreters that share the module must not change it while they
+		/// run, so this is done before any of them has run the program.
+		void lowerIntrinsics();
+
+		/// skipRuns - Number the next run of the process n higher, e.g. in a
+		/// worker of lli-synth -j, which runs its own block of the runs.  The
+		/// number selects the seed and the schedule log of a run.
+		static void skipRuns(unsigned n);
+
+		/// hasCheckpoint - Whether the next run of main starts from the state
+		/// after the first spawn_thread (CHECKPOINT = true).
+		bool hasCheckpoint() const {
+			return checkpoint.Valid;
+		}
+
+		/// invalidateConstantPool - Forget the folded constants; called when the
+		/// module is changed, e.g. by Constraints::InsertFences.
+		void invalidateConstantPool() {
+			ConstantPool.clear();
+		}
+
 		/// runAtExitHandlers - Run any functions registered by the program's calls to
 		/// atexit(3), which we intercept and store in AtExitHandlers.
 		///
@@ -245,6 +597,7 @@ namespace llvm {
 		// Methods used to execute code:
 		// Place a call on the stack
 		void callFunction(Function *F, const std::vector<GenericValue> &ArgVals);
+		void callFunction(FunctionInfo *FI, const std::vector<GenericValue> &ArgVals);
 		void run();                // Execute instructions until nothing left to do
 
 		// Opcode Implementations
@@ -261,12 +614,10 @@ namespace llvm {
 		void visitLoadInstNoWmm(LoadInst &I);
 		void visitLoadInstTSO(LoadInst &I);
 		void visitLoadInstPSO(LoadInst &I);
-		void visitLoadInst(LoadInst &I);
 
 		void visitStoreInstNoWmm(StoreInst &I);
 		void visitStoreInstTSO(StoreInst &I);
 		void visitStoreInstPSO(StoreInst &I);
-		void visitStoreInst(StoreInst &I);
 
 		void visitGetElementPtrInst(GetElementPtrInst &I);
 		void visitPHINode(PHINode &PN) {
@@ -327,7 +678,7 @@ namespace llvm {
 		void visitKeyGetSpecific(ExecutionContext &SF);
 		void visitKeySetSpecific(ExecutionContext &SF);
 
-		GenericValue callExternalFunction(Function *F,
+		GenericValue callExternalFunction(FunctionInfo *FI,
 				const std::vector<GenericValue> &ArgVals);
 		void exitCalled(GenericValue GV);
 
@@ -349,7 +700,15 @@ namespace llvm {
 
 		void getInvokeHistoryData(ExecutionContext&); 		
 		// get a list of all threads that have something left to execute		
-		vector<Thread> getAllActiveThreads() const;		  
+		const vector<Thread> &getAllActiveThreads() const {
+			return enabledThreads;
+		}		  
+		// get the active threads that are neither waiting in join_all nor
+		// spinning, or if there are none, those that do not wait
+		const vector<Thread> &getRunnableThreads() const {
+			return runnableThreads;
+		}
+		bool isSpinning(Thread t) const;
 		// flushes all buffers that have something to left to flush (execute at the end of program)
 		void flushAll();
 
@@ -401,32 +760,28 @@ namespace llvm {
 		void createThread(GenericValue);
 		// dump state dumps the current state. Not usable.
 		void dumpState(Instruction&);
-		// checks if a address is on the stack
+		// checks if a address is on the stack of the current thread
 		// works both with virtual memory and without
 		// if virtual memory is used then the virtual address must be given
 		bool isAddressOnStack(void *mem, ExecutionContext& SF);
-		// frees the memory contained by a stack frame just before it is destroyed
-		// it is implemented bacause Allocas can't know the native addresses
-		void freeAllocas(ExecutionContext&);
 		// isWorkingWithGlobalMemory decides if a function is working with the global memory; load or store
 		bool isWorkingWithGlobalMemory(Instruction&) const;
 		bool isThreadBufferNonEmpty(Thread);
 		void processFile();
 #if defined(VIRTUALMEMORY)
-		// this function given a virtual pointer returns the virtual base address in the given stack frame
-		// that points to the memory that the given pointer is pointing to.
-		// returns NULL if it cannot be mapped with base address on the given stack frame
-		void *getVirtualBaseAddressStack(void *,ExecutionContext&);
+		// this function given a virtual pointer returns the native address on the stack of
+		// the current thread, or NULL if the pointer is not into one of its allocas
+		void *getNativeAddressStack(void *);
 		// getNativeAddressFull - returns the native address for a given virtual address and ExecutionContext
 		// it works for all addresses, not only for base addresses
-		// returns NULL if it cannot map the address with address in the heap + Global Variables or in the given stack frame
+		// returns NULL if it cannot map the address with address in the heap + Global Variables or in the stack of the current thread
 		void *getNativeAddressFull(void *, ExecutionContext&);
 		// getNativeAddressGlobal is the same as getNativeAddressFull but only for global variables without giving ExecutionContext
 		void *getNativeAddressGlobal(void*);
 		void printMap();
 #endif
 		/*
-		// loadValue is like visitLoadInst but instead instruction in receives the address and returns the value
+		// loadValue is like the load visitors, but receives the address instead of an instruction and returns the value
 		GenericValue loadValueNoWmm(void*, const Type*);
 		GenericValue loadValueTSO(void*, const Type*);
 		GenericValue loadValuePSO(void*, const Type*);
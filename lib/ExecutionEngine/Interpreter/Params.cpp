@@ -21,7 +21,17 @@ double Params::flushProb = 1;
 int Params::Property = PROP_NONE;
 int Params::WMM = WMM_NONE;
 int Params::Scheduler = RANDOM;
+unsigned Params::pctDepth = 3;
+unsigned Params::pctLength = 100;
+unsigned Params::maxBound = 2;
+unsigned Params::boundTime = 0;
+unsigned long Params::traceSteps = 0;
+unsigned Params::traceTime = 0;
+unsigned long Params::roundSteps = 0;
+unsigned Params::roundTime = 0;
 bool Params::logging = false;
+bool Params::coverage = false;
+bool Params::checkpoint = false;
 set<string> Params::funcs_rec;
 program_type Params::programToCheck;
 
@@ -57,6 +67,66 @@ void Params::processInputFile() {
 			flushProb = atof(tmpString.c_str());
 			cout << "Flush Probability: " << flushProb << endl;
 		}
+		else if (str == "PCTDEPTH") {
+			fin >> tmpString;
+			fin >> tmpString;
+			int depth = atoi(tmpString.c_str());
+			ASSERT(depth >= 1, "PCTDEPTH must be at least 1");
+			pctDepth = depth;
+			cout << "PCT depth: " << pctDepth << endl;
+		}
+		else if (str == "PCTLENGTH") {
+			fin >> tmpString;
+			fin >> tmpString;
+			int length = atoi(tmpString.c_str());
+			ASSERT(length >= 1, "PCTLENGTH must be at least 1");
+			pctLength = length;
+			cout << "PCT expected trace length: " << pctLength << endl;
+		}
+		else if (str == "BOUND") {
+			fin >> tmpString;
+			fin >> tmpString;
+			int bound = atoi(tmpString.c_str());
+			ASSERT(bound >= 0, "BOUND must be at least 0");
+			maxBound = bound;
+			cout << "Preemption and delayed flush bound: " << maxBound << endl;
+		}
+		else if (str == "TRACESTEPS") {
+			fin >> tmpString;
+			fin >> tmpString;
+			traceSteps = strtoul(tmpString.c_str(), NULL, 10);
+			cout << "Instruction budget of a trace: " << traceSteps << endl;
+		}
+		else if (str == "TRACETIME") {
+			fin >> tmpString;
+			fin >> tmpString;
+			int seconds = atoi(tmpString.c_str());
+			ASSERT(seconds >= 0, "TRACETIME must be at least 0");
+			traceTime = seconds;
+			cout << "Time budget of a trace: " << traceTime << " s" << endl;
+		}
+		else if (str == "ROUNDSTEPS") {
+			fin >> tmpString;
+			fin >> tmpString;
+			roundSteps = strtoul(tmpString.c_str(), NULL, 10);
+			cout << "Instruction budget of a round: " << roundSteps << endl;
+		}
+		else if (str == "ROUNDTIME") {
+			fin >> tmpString;
+			fin >> tmpString;
+			int seconds = atoi(tmpString.c_str());
+			ASSERT(seconds >= 0, "ROUNDTIME must be at least 0");
+			roundTime = seconds;
+			cout << "Time budget of a round: " << roundTime << " s" << endl;
+		}
+		else if (str == "BOUNDTIME") {
+			fin >> tmpString;
+			fin >> tmpString;
+			int seconds = atoi(tmpString.c_str());
+			ASSERT(seconds >= 0, "BOUNDTIME must be at least 0");
+			boundTime = seconds;
+			cout << "Time budget of a bounded round: " << boundTime << " s" << endl;
+		}
 		else if (str == "WMM") {
 			fin >> tmpString;
 			fin >> tmpString;
@@ -151,6 +221,36 @@ void Params::processInputFile() {
 				ASSERT(0, "Only true/false values recognised for logging option");
 			}
 		}
+		else if (str == "COVERAGE") {
+			fin >> tmpString;
+			fin >> tmpString;
+			if (tmpString == "true") {
+				coverage = true;
+				cout << "Coverage-guided flushing: yes" << endl;
+			}
+			else if (tmpString == "false") {
+				coverage = false;
+				cout << "Coverage-guided flushing: no" << endl;
+			}
+			else {
+				ASSERT(0, "Only true/false values recognised for coverage option");
+			}
+		}
+		else if (str == "CHECKPOINT") {
+			fin >> tmpString;
+			fin >> tmpString;
+			if (tmpString == "true") {
+				checkpoint = true;
+				cout << "Start traces from the first spawn_thread: yes" << endl;
+			}
+			else if (tmpString == "false") {
+				checkpoint = false;
+				cout << "Start traces from the first spawn_thread: no" << endl;
+			}
+			else {
+				ASSERT(0, "Only true/false values recognised for checkpoint option");
+			}
+		}
 		else if (str == "SCHEDULER") {
 			fin >> tmpString;
 			fin >> tmpString;
@@ -158,6 +258,22 @@ void Params::processInputFile() {
 				Scheduler = RANDOM;
 				cout << "Scheduler: RANDOM (empty buffers CAN be chosen for flushing)" << endl;
 			}
+			else if (tmpString == "DPOR") {
+				Scheduler = DPOR;
+				cout << "Scheduler: DPOR (systematic exploration, FLUSHPROB is not used)" << endl;
+			}
+			else if (tmpString == "PREDICTIVE") {
+				Scheduler = PREDICTIVE;
+				cout << "Scheduler: PREDICTIVE (RANDOM, steered by the reorderings predicted from earlier traces)" << endl;
+			}
+			else if (tmpString == "BOUNDED") {
+				Scheduler = BOUNDED;
+				cout << "Scheduler: BOUNDED (iterative context bounding, FLUSHPROB is not used)" << endl;
+			}
+			else if (tmpString == "PCT") {
+				Scheduler = PCT;
+				cout << "Scheduler: PCT (random priorities, FLUSHPROB is not used)" << endl;
+			}
 			else {
 				ASSERT(0, "The given type of scheduler cannot be recognized!");			
 			}
@@ -168,6 +284,9 @@ void Params::processInputFile() {
 		}
 	}
 
+	ASSERT(Scheduler != PREDICTIVE || logging, "The PREDICTIVE scheduler needs LOG = true");
+	ASSERT(!coverage || logging, "COVERAGE = true needs LOG = true");
+
 	if (Property == PROP_LIN || Property == PROP_SC) {
 
 		string tmp;
@@ -28,7 +28,7 @@ namespace llvm {
 typedef enum {NO_PROGRAM, WSQ_CHASE, WSQ_LIFO, WSQ_FIFO, WSQ_THE, WSQ_ANCHOR, 
 							LF_MALLOC, SKIP_LIST,
 							QUEUE, DEQUE, LINKSET} program_type;
-typedef enum {RANDOM, DBRR, PREDICTIVE} scheduler_type;
+typedef enum {RANDOM, DBRR, PREDICTIVE, DPOR, PCT, BOUNDED} scheduler_type;
 
 #define CONFDIR		"CONFDIR"
 #define FLUSHPROB	"FLUSHPROB"
@@ -59,9 +59,19 @@ public:
 	static int Property;
 	static int WMM;
 	static int Scheduler;
+	static unsigned pctDepth;   // PCT: the bug depth d, d-1 priority changes
+	static unsigned pctLength;  // PCT: the expected number of decisions of a trace
+	static unsigned maxBound;   // BOUNDED: the most preemptions and delayed flushes
+	static unsigned boundTime;  // BOUNDED: seconds a round may explore, 0 for no limit
+	static unsigned long traceSteps;  // instructions a trace may run, 0 for no limit
+	static unsigned traceTime;        // seconds a trace may run, 0 for no limit
+	static unsigned long roundSteps;  // instructions the traces of a round may run
+	static unsigned roundTime;        // seconds a round of lli-synth may run
 	static std::set<std::string> funcs_rec;
 	static program_type programToCheck;
 	static bool logging;
+	static bool coverage;   // RANDOM keeps the stores reordered in few traces buffered longer
+	static bool checkpoint; // traces after the first start from its first spawn_thread
 };
 }
 #endif
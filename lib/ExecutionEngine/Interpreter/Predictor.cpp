@@ -0,0 +1,169 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "interpreter"
+#include "Predictor.h"
+#include "Params.h"
+#include "llvm/Support/Debug.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace llvm;
+
+// A round seldom runs more traces than this, so more reorderings are dropped.
+static const unsigned MaxQueued = 10000;
+
+static TracePredictor ThePredictor;
+
+TracePredictor &TracePredictor::get() {
+	return ThePredictor;
+}
+
+void TracePredictor::restart() {
+	Queue.clear();
+	Predicted.clear();
+	Traces = 0;
+	Steered = 0;
+}
+
+bool TracePredictor::nextReordering(Reordering &R) {
+	if (Queue.empty())
+		return false;
+	R = Queue.front();
+	Queue.pop_front();
+	++Steered;
+	return true;
+}
+
+// A store buffer: the thread, and under PSO the address.
+typedef std::pair<int, int*> BufferKey;
+
+static BufferKey bufferOf(int tid, int *location) {
+	return BufferKey(tid, Params::WMM == WMM_PSO ? location : 0);
+}
+
+void TracePredictor::analyze(const std::vector<rwtrace_elem> &trace) {
+	// without store buffers there is nothing selectPredictive could steer
+	if (Params::WMM == WMM_NONE)
+		return;
+	unsigned N = trace.size();
+	// for a store: when it reached memory, the first drain of its buffer after
+	// it, and the store it overwrote; for a read: the store it read from.  N
+	// stands for never, for the initial value and for a forwarded store.
+	std::vector<unsigned> Visible(N, N), Limit(N, N), Previous(N, N), Source(N, N);
+	std::map<BufferKey, std::deque<unsigned> > Buffers;
+	std::map<BufferKey, std::vector<unsigned> > Undrained;  // since the last drain
+	std::map<int*, unsigned> LastVisible;
+	std::map<int, std::vector<unsigned> > Accesses;         // per thread
+
+	for (unsigned i = 0; i < N; ++i) {
+		const rwtrace_elem &E = trace[i];
+		int tid = E.thr.tid();
+		std::vector<BufferKey> flushed;  // buffers whose oldest store reaches memory
+		std::vector<BufferKey> drained;  // buffers that reach memory as a whole
+
+		if (E.type == WRITE) {
+			Accesses[tid].push_back(i);
+			BufferKey K = bufferOf(tid, E.location);
+			Buffers[K].push_back(i);
+			Undrained[K].push_back(i);
+		} else if (E.type == READ) {
+			Accesses[tid].push_back(i);
+			const std::deque<unsigned> &B = Buffers[bufferOf(tid, E.location)];
+			bool forwarded = false;
+			for (unsigned k = 0; k < B.size() && !forwarded; ++k)
+				forwarded = trace[B[k]].location == E.location;
+			std::map<int*, unsigned>::iterator It = LastVisible.find(E.location);
+			if (!forwarded && It != LastVisible.end())
+				Source[i] = It->second;
+		} else if (E.type == FLUSH_RANDOM_TSO || E.type == FLUSH_RANDOM_PSO) {
+			flushed.push_back(bufferOf(tid, E.location));
+		} else if (E.type == FLUSH_CAS_PSO) {
+			drained.push_back(bufferOf(tid, E.location));
+		} else if (E.type == FLUSH_FENCE || E.type == FLUSH_INSTR ||
+				E.type == FLUSH_CAS_TSO) {
+			for (std::map<BufferKey, std::vector<unsigned> >::iterator
+					It = Undrained.begin(); It != Undrained.end(); ++It)
+				if (It->first.first == tid)
+					drained.push_back(It->first);
+		}
+
+		for (unsigned k = 0; k < drained.size(); ++k) {
+			std::vector<unsigned> &U = Undrained[drained[k]];
+			for (unsigned j = 0; j < U.size(); ++j)
+				Limit[U[j]] = i;
+			U.clear();
+			unsigned n = Buffers[drained[k]].size();
+			for (unsigned j = 0; j < n; ++j)
+				flushed.push_back(drained[k]);
+		}
+		for (unsigned k = 0; k < flushed.size(); ++k) {
+			std::deque<unsigned> &B = Buffers[flushed[k]];
+			if (B.empty())
+				continue;
+			unsigned w = B.front();
+			B.pop_front();
+			Visible[w] = i;
+			std::map<int*, unsigned>::iterator It = LastVisible.find(trace[w].location);
+			if (It != LastVisible.end()) {
+				Previous[w] = It->second;
+				It->second = w;
+			} else {
+				LastVisible.insert(std::make_pair(trace[w].location, w));
+			}
+		}
+	}
+
+	// the first read of another thread that a delay of the store changes
+	std::map<unsigned, unsigned> ChangedRead;
+	for (unsigned r = 0; r < N; ++r) {
+		unsigned s = Source[r];
+		if (trace[r].type != READ || s == N || trace[r].label == 0 ||
+				trace[s].label == 0 || trace[s].thr == trace[r].thr)
+			continue;
+		if (r >= Limit[s] || ChangedRead.count(s))
+			continue;
+		if (Previous[s] == N || trace[Previous[s]].value != trace[s].value)
+			ChangedRead[s] = r;
+	}
+
+	unsigned added = 0;
+	for (std::map<unsigned, unsigned>::iterator It = ChangedRead.begin();
+			It != ChangedRead.end() && Queue.size() < MaxQueued; ++It) {
+		unsigned s = It->first;
+		const std::vector<unsigned> &A = Accesses[trace[s].thr.tid()];
+		// the accesses that ran after the store reached memory, before its drain
+		std::vector<unsigned>::const_iterator a =
+			std::upper_bound(A.begin(), A.end(), Visible[s]);
+		for ( ; a != A.end() && *a < Limit[s]; ++a) {
+			const rwtrace_elem &E = trace[*a];
+			if (E.location == trace[s].location || E.label == 0)
+				continue;
+			if (E.type == WRITE && Params::WMM != WMM_PSO)
+				continue;
+			if (!Predicted.insert(std::make_pair(trace[s].label, E.label)).second)
+				continue;
+			Reordering R;
+			R.Store = trace[s].label;
+			R.Access = E.label;
+			R.Read = trace[It->second].label;
+			Queue.push_back(R);
+			++added;
+		}
+	}
+
+	++Traces;
+	DEBUG(dbgs() << "PREDICTIVE: " << added << " reorderings predicted from trace "
+		<< Traces << ", " << Queue.size() << " queued, " << Steered
+		<< " steered\n");
+}
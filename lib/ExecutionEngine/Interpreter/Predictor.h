@@ -0,0 +1,79 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLI_PREDICTOR_H
+#define LLI_PREDICTOR_H
+
+#include "RWHistory.h"
+
+#include <deque>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+	// Reordering - A store whose flush a trace should delay: the thread that
+	// runs Store keeps it buffered until it has run Access (a load, or under
+	// PSO also a store, to another address), and then until another thread has
+	// run Read, which reads the address of the store and so sees the older
+	// value.  All three are instruction labels, which stay the same across the
+	// traces of a round, unlike addresses and values.
+	struct Reordering {
+		int Store;
+		int Access;
+		int Read;
+	};
+
+	// TracePredictor - Prediction of the reorderings one trace can be turned
+	// into (the scheduler SCHEDULER = PREDICTIVE).
+	//
+	// From the shared reads and writes of a trace it replays the store buffers
+	// to find when every store reached memory and which store every read read
+	// from.  A store can be flushed later, up to the next fence or atomic of its
+	// thread, without making any other event infeasible; if a read of another
+	// thread reads from it within that window, and the store changed the value,
+	// the delay changes what that read sees.  Every access of the thread in the
+	// window to another address is then a store->load (or, under PSO,
+	// store->store) pair the delayed trace reorders, the pairs that become
+	// constraints when the trace violates the specification.
+	//
+	// Every pair is predicted once per round and queued; each following run
+	// takes one and steers towards it, the rest of its decisions are random.
+	//
+	class TracePredictor {
+		std::deque<Reordering> Queue;
+		std::set<std::pair<int, int> > Predicted;  // store and access labels
+		unsigned Traces;
+		unsigned Steered;
+
+		public:
+		TracePredictor() : Traces(0), Steered(0) {}
+
+		// get - The predictor of the process.
+		static TracePredictor &get();
+
+		// analyze - Predict the reorderings of a finished trace, given its
+		// shared accesses (RWHistory::shared_rec).
+		void analyze(const std::vector<rwtrace_elem> &trace);
+
+		// nextReordering - The reordering the next run steers towards; returns
+		// false if none is left.
+		bool nextReordering(Reordering &R);
+
+		// restart - Forget the predictions, e.g. after the program changed.
+		void restart();
+	};
+
+}
+
+#endif
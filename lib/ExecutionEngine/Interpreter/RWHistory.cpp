@@ -26,8 +26,11 @@
 using std::cout;
 using namespace llvm;
 
+RWHistory::RWHistory() : enabled(Params::logging) {
+}
+
 // parameter type tells us whether we are recording read or write (true for read and false for write)
-void RWHistory::RecordRWEvent(GenericValue ptr, GenericValue val,Thread thr, RWType type, int label) {
+void RWHistory::AppendRWEvent(GenericValue ptr, GenericValue val,Thread thr, RWType type, int label) {
 	assert((type == READ || type == WRITE) && "A wrong RECORD function is called!");
 	rwtrace_elem elem;
 	
@@ -40,7 +43,7 @@ void RWHistory::RecordRWEvent(GenericValue ptr, GenericValue val,Thread thr, RWT
 	rwtrace_rec.push_back(elem);
 }
 
-void RWHistory::RecordRWEvent(Thread thr, RWType type, int label) {
+void RWHistory::AppendRWEvent(Thread thr, RWType type, int label) {
 	assert((type == FLUSH_FENCE || type == FLUSH_CAS_TSO || 
 					type == FLUSH_INSTR || type == FLUSH_RANDOM_TSO ||
 				 	type == SPAWN || type == JOIN) && 
@@ -55,7 +58,7 @@ void RWHistory::RecordRWEvent(Thread thr, RWType type, int label) {
 	rwtrace_rec.push_back(elem);
 }
 
-void RWHistory::RecordRWEvent(GenericValue ptr, Thread thr, RWType type, int label) {
+void RWHistory::AppendRWEvent(GenericValue ptr, Thread thr, RWType type, int label) {
 	assert((type == FLUSH_CAS_PSO || type == FLUSH_RANDOM_PSO) && 
          "A wrong RECORED function is called!");
 
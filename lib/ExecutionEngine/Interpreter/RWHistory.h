@@ -41,16 +41,35 @@ public:
 	vector<rwtrace_elem> shared_rec;  	
 	// recorded trace on all non-local variables
   vector<rwtrace_elem> rwtrace_rec;  	
+	// whether events are recorded at all; only FindSharedRW reads them, and
+	// only when LOG = true, so the interpreter pays for no logging otherwise
+	const bool enabled;
+	RWHistory();
 	// records a load operation of non-local variable
-  void RecordRWEvent(GenericValue, GenericValue, Thread, RWType, int);
+  void RecordRWEvent(GenericValue ptr, GenericValue val, Thread thr, RWType type, int label) {
+		if (enabled) AppendRWEvent(ptr, val, thr, type, label);
+	}
 	// records a flush operation of non-local variable
 	// records a spawn or join instruction, even though it is not a RW instr
-  void RecordRWEvent(Thread, RWType, int);
-  void RecordRWEvent(GenericValue, Thread, RWType, int);
+  void RecordRWEvent(Thread thr, RWType type, int label) {
+		if (enabled) AppendRWEvent(thr, type, label);
+	}
+  void RecordRWEvent(GenericValue ptr, Thread thr, RWType type, int label) {
+		if (enabled) AppendRWEvent(ptr, thr, type, label);
+	}
 	// finds the trace of all SHARED accesses. 
 	// Use it after you have recorded all stores and loads of non-local variables
 	void FindSharedRW();  
 	void PrintSharedRW();  
+	// forgets the trace, for the next run of the program
+	void clear() {
+		shared_rec.clear();
+		rwtrace_rec.clear();
+	}
+private:
+  void AppendRWEvent(GenericValue, GenericValue, Thread, RWType, int);
+  void AppendRWEvent(Thread, RWType, int);
+  void AppendRWEvent(GenericValue, Thread, RWType, int);
 };
  
 #endif
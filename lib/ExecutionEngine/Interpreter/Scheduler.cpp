@@ -11,11 +11,44 @@
 //===----------------------------------------------------------------------===//
 
 #include "Scheduler.h"
+#include "Constraints.h"
+#include "ContextBound.h"
+#include "DPOR.h"
 #include "Params.h"
+#include "llvm/Support/CommandLine.h"
+#include <sys/time.h>
+#include <algorithm>
+#include <cstring>
+
+static cl::opt<unsigned> Seed("seed",
+		cl::desc("Seed of the scheduler's random decisions (default: the clock)"),
+		cl::value_desc("n"));
+
+static cl::opt<std::string> RecordSchedule("record-schedule",
+		cl::desc("Record the scheduler's actions to this file "
+			"(run k > 1 of a process writes <file>.k)"),
+		cl::value_desc("filename"));
+
+static cl::opt<std::string> ReplaySchedule("replay-schedule",
+		cl::desc("Replay the scheduler's actions from a file written by "
+			"-record-schedule instead of making random decisions"),
+		cl::value_desc("filename"));
+
+static const char ScheduleMagic[8] = { 'D', 'F', 'S', 'C', 'H', 'E', 'D', '1' };
+
+// scheduleFileName - The log of the given run; runs after the first one get
+// their number appended.
+static std::string scheduleFileName(const std::string &name, unsigned runNumber) {
+	if (runNumber <= 1)
+		return name;
+	char suffix[16];
+	sprintf(suffix, ".%u", runNumber);
+	return name + suffix;
+}
 
 typedef vector<Thread> Threads;
-bool belongsTo(Threads thds, Thread thd) {
-	Threads::iterator it;
+bool belongsTo(const Threads &thds, Thread thd) {
+	Threads::const_iterator it;
 	for (it = thds.begin(); it < thds.end(); it++) {
 		if (*it == thd) {
 			return true;
@@ -24,8 +57,8 @@ bool belongsTo(Threads thds, Thread thd) {
 	return false;
 }
 
-Thread pickUpNextThreadRR(Threads thds, Thread thd) {
-	Threads::iterator it;
+Thread pickUpNextThreadRR(const Threads &thds, Thread thd) {
+	Threads::const_iterator it;
 	for (it = thds.begin(); it < thds.end(); it++) {
 		if (*it > thd) {
 			break;
@@ -42,10 +75,222 @@ Thread pickUpNextThreadRR(Threads thds, Thread thd) {
 unsigned CSCounter = 0; 	   // context switch counter
 unsigned PreemptiveCSCounter = 0; // preemptive context switch counter
 
-Action Scheduler::selectAction(const Interpreter* interpreter) const {
-	vector<Thread> enabled;
-	enabled = interpreter->getAllActiveThreads();
+//===----------------------------------------------------------------------===//
+// ScheduleLog
+//
+
+void ScheduleLog::putNumber(unsigned n) {
+	while (n >= 0x80) {
+		fputc((int)(n & 0x7f) | 0x80, File);
+		n >>= 7;
+	}
+	fputc((int)n, File);
+}
+
+bool ScheduleLog::getNumber(unsigned &n) {
+	n = 0;
+	for (unsigned shift = 0; shift < 32; shift += 7) {
+		int c = fgetc(File);
+		if (c == EOF)
+			return false;
+		n |= (unsigned)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+void ScheduleLog::create(const std::string &name, unsigned seed) {
+	File = fopen(name.c_str(), "wb");
+	ASSERT(File != NULL, "cannot create the schedule log");
+	Writing = true;
+	fwrite(ScheduleMagic, 1, sizeof(ScheduleMagic), File);
+	putNumber(seed);
+}
+
+unsigned ScheduleLog::open(const std::string &name) {
+	File = fopen(name.c_str(), "rb");
+	ASSERT(File != NULL, "cannot open the schedule log");
+	Writing = false;
+	char magic[sizeof(ScheduleMagic)];
+	unsigned seed;
+	ASSERT(fread(magic, 1, sizeof(magic), File) == sizeof(magic) &&
+			memcmp(magic, ScheduleMagic, sizeof(magic)) == 0 && getNumber(seed),
+			"not a schedule log");
+	return seed;
+}
+
+void ScheduleLog::close() {
+	if (File != NULL)
+		fclose(File);
+	File = NULL;
+}
+
+void ScheduleLog::write(const Action &action, unsigned psoIndex) {
+	unsigned tid = action.thread.tid();
+	fputc((int)action.type | (int)(tid < 63 ? tid : 63) << 2, File);
+	if (tid >= 63)
+		putNumber(tid);
+	if (action.type == FLUSH_BUFFER && Params::WMM == WMM_PSO)
+		putNumber(psoIndex);
+}
+
+bool ScheduleLog::read(Action &action, unsigned &psoIndex) {
+	int c = fgetc(File);
+	if (c == EOF)
+		return false;
+	action.type = (ActionType)(c & 3);
+	unsigned tid = (unsigned)c >> 2;
+	if (tid == 63 && !getNumber(tid))
+		return false;
+	action.thread = Thread((int)tid);
+	if (action.type == FLUSH_BUFFER && Params::WMM == WMM_PSO)
+		return getNumber(psoIndex);
+	return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Scheduler
+//
+
+unsigned Scheduler::getSeed(unsigned runNumber) {
+	if (!ReplaySchedule.empty()) {
+		ScheduleLog replay;
+		return replay.open(scheduleFileName(ReplaySchedule, runNumber));
+	}
+	if (Seed.getNumOccurrences())
+		return Seed + runNumber - 1;
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return (unsigned)(tv.tv_sec * 1000003 + tv.tv_usec + runNumber);
+}
+
+bool Scheduler::usesLog() {
+	return !RecordSchedule.empty() || !ReplaySchedule.empty();
+}
+
+Scheduler::Scheduler(unsigned seed, unsigned runNumber)
+	: random(seed), psoIndex(0), rrThread(-1), steps(0), runLength(0),
+	  lastSwitched(false) {
+	if (!ReplaySchedule.empty())
+		log.open(scheduleFileName(ReplaySchedule, runNumber));
+	else if (!RecordSchedule.empty())
+		log.create(scheduleFileName(RecordSchedule, runNumber), seed);
+	exploring = Params::Scheduler == DPOR && !log.isReading();
+	if (exploring)
+		DPORExplorer::get().beginTrace();
+	bounding = Params::Scheduler == BOUNDED && !log.isReading();
+	if (bounding)
+		BoundedExplorer::get().beginTrace();
+
+	steerPhase = STEER_NONE;
+	if (Params::Scheduler == PREDICTIVE && !log.isReading() &&
+			TracePredictor::get().nextReordering(target))
+		steerPhase = STEER_WAIT;
+
+	if (Params::Scheduler == PCT) {
+		// d-1 distinct change points among the expected number of decisions
+		unsigned points = std::min(Params::pctDepth - 1, Params::pctLength);
+		while (changePoints.size() < points) {
+			unsigned step = random.below(Params::pctLength) + 1;
+			if (std::find(changePoints.begin(), changePoints.end(), step) ==
+					changePoints.end())
+				changePoints.push_back(step);
+		}
+	}
+}
+
+Scheduler::~Scheduler() {
+	if (exploring)
+		DPORExplorer::get().endTrace();
+	if (bounding)
+		BoundedExplorer::get().endTrace();
+}
+
+Action Scheduler::selectAction(const Interpreter* interpreter) {
+	if (log.isReading())
+		return replayAction(interpreter);
+	Action action = decideAction(interpreter);
+	if (log.isWriting())
+		log.write(action, psoIndex);
+	return action;
+}
+
+void Scheduler::collectEntities(const Interpreter* interpreter,
+		const std::vector<char> &waiting, std::vector<ScheduleEntity> &entities) {
+	entities.clear();
+	const vector<Thread> &threads = interpreter->getAllActiveThreads();
+	for (unsigned i = 0; i < threads.size(); ++i) {
+		int tid = threads[i].tid();
+		// join_all waits only while other threads run
+		if ((unsigned)tid >= waiting.size() || !waiting[tid] || threads.size() == 1)
+			entities.push_back(ScheduleEntity(tid));
+	}
+	if (Params::WMM == WMM_TSO) {
+		for (unsigned t = 0; t < interpreter->thread_buffer_tso.size(); ++t)
+			if (!interpreter->thread_buffer_tso.find(Thread(t))->empty())
+				entities.push_back(ScheduleEntity(t, true));
+	} else if (Params::WMM == WMM_PSO) {
+		for (unsigned t = 0; t < interpreter->thread_buffer_pso.size(); ++t) {
+			const PSOBuffer *buffer = interpreter->thread_buffer_pso.find(Thread(t));
+			for (unsigned i = 0; i < buffer->getNumAddresses(); ++i)
+				entities.push_back(ScheduleEntity(t, true, buffer->getAddress(i)));
+		}
+	}
+	if (entities.empty()) {
+		// every thread waits in join_all
+		for (unsigned i = 0; i < threads.size(); ++i)
+			entities.push_back(ScheduleEntity(threads[i].tid()));
+	}
+}
+
+Action Scheduler::entityAction(const Interpreter* interpreter,
+		const ScheduleEntity &entity, unsigned &psoIndex) {
+	Action action;
+	action.thread = Thread(entity.Tid);
+	if (!entity.Flush) {
+		action.type = SWITCH_THREAD;
+	} else {
+		action.type = FLUSH_BUFFER;
+		if (Params::WMM == WMM_PSO) {
+			action.pso_var = GenericValue(entity.Addr);
+			const PSOBuffer *buffer = interpreter->thread_buffer_pso.find(action.thread);
+			for (psoIndex = 0; buffer->getAddress(psoIndex) != entity.Addr; ++psoIndex)
+				;
+		}
+	}
+	return action;
+}
+
+Action Scheduler::replayAction(const Interpreter* interpreter) {
 	Action action;
+	unsigned index = 0;
+	ASSERT(log.read(action, index), "the schedule log ended before the program");
+	if (action.type == FLUSH_BUFFER && Params::WMM == WMM_PSO) {
+		const PSOBuffer *buffer = interpreter->thread_buffer_pso.find(action.thread);
+		ASSERT(buffer != NULL && index < buffer->getNumAddresses(),
+				"the schedule log does not match the program");
+		action.pso_var = GenericValue(buffer->getAddress(index));
+	}
+	return action;
+}
+
+Action Scheduler::decideAction(const Interpreter* interpreter) {
+	if (exploring)
+		return DPORExplorer::get().selectAction(interpreter, psoIndex);
+	if (bounding)
+		return BoundedExplorer::get().selectAction(interpreter, psoIndex);
+
+	const vector<Thread> &enabled = interpreter->getAllActiveThreads();
+	Action action;
+
+	if (interpreter->awaitsCheckpoint()) {
+		// the stores of main stay buffered up to the checkpoint, so that the
+		// traces that start from it can flush them at any time
+		action.type = SWITCH_THREAD;
+		action.thread = interpreter->getCurrThread();
+		return action;
+	}
 
 	if (interpreter->instr_info.isBlocked) {
 		return selectAction1(interpreter);	
@@ -66,64 +311,22 @@ Action Scheduler::selectAction(const Interpreter* interpreter) const {
 	}
 }
 
-Action Scheduler::selectAction1(const Interpreter* interpreter) const {
+Action Scheduler::selectAction1(const Interpreter* interpreter) {
 
 	if (Params::Scheduler == RANDOM) {
-		vector<Thread> enabled;
-		Action action;
-		// find all active threads
-		enabled = interpreter->getAllActiveThreads();
-		// decide what to do: switch thread or flush memory
-		if (Params::WMM == WMM_NONE || ((double) rand()/RAND_MAX) > Params::flushProb) {  
-			// switch thread
-			action.type = SWITCH_THREAD;
-			action.thread = enabled[rand() % enabled.size()];
-		} else {  																																				
-			// flush memory
-			if (Params::WMM == WMM_NONE) {
-				action.type = NO_ACTION;
-			} else if (Params::WMM == WMM_TSO) {
-				action.type = FLUSH_BUFFER;
-				action.thread = enabled[rand() % enabled.size()];
-			} else if (Params::WMM == WMM_PSO) {
-	  		action.thread = enabled[rand() % enabled.size()];
-		      	std::map<GenericValue, std::list<GenericValue> >::const_iterator mits, mite, mit;
-	  		std::vector<GenericValue> possibleAddress;
-	  		Thread ta = action.thread;
-	  		std::map<Thread, std::map<GenericValue, std::list<GenericValue> > > to = 
-          interpreter->thread_buffer_pso;
-
-	  		mits = to[ta].begin();
-	  		mite = to[ta].end();
-
-	  		for (mit = mits; mit != mite; ++mit) {
-					if(!mit->second.empty()) {
-						possibleAddress.push_back(mit->first);
-					}
-      	}
-
-	  		if (possibleAddress.size() != 0) {
-					action.type = FLUSH_BUFFER;
-		    	action.pso_var = possibleAddress[rand() % possibleAddress.size() ];
-		 		} else {
-					action.type = NO_ACTION;
-		 		}
-			}
-		}
-		return action;
+		return selectRandom(interpreter);
 	}
 
 	else if (Params::Scheduler == DBRR) {
-		static Thread thdIndex(-1);
-		vector<Thread> enabled = interpreter->getAllActiveThreads();
+		const vector<Thread> &enabled = interpreter->getRunnableThreads();
 		Action action;
 
 		// round robin scheduling to pick up an available thread 
-		thdIndex = pickUpNextThreadRR(enabled, thdIndex);
+		rrThread = pickUpNextThreadRR(enabled, rrThread);
 
 		// decide whether flush buffer or execute instruction
-		action.thread = thdIndex;
-		if (((double)rand()/RAND_MAX) > Params::flushProb) {   
+		action.thread = rrThread;
+		if (random.uniform() > Params::flushProb) {   
 		        // execute instruction
 			action.type = SWITCH_THREAD;
 		} 
@@ -141,10 +344,12 @@ Action Scheduler::selectAction1(const Interpreter* interpreter) const {
 		return action;
 	}
 
-	else if (Params::Scheduler == PREDICTIVE) {
-		Action action;
+	else if (Params::Scheduler == PCT) {
+		return selectPCT(interpreter);
+	}
 
-		return action;
+	else if (Params::Scheduler == PREDICTIVE) {
+		return selectPredictive(interpreter);
 	}
 
 	else {
@@ -154,3 +359,191 @@ Action Scheduler::selectAction1(const Interpreter* interpreter) const {
 		return action;	
 	}
 }
+
+// selectRandom - The RANDOM scheduler.
+Action Scheduler::selectRandom(const Interpreter* interpreter) {
+	Action action;
+	// find all active threads, and those worth running: a thread that waits in
+	// join_all or spins still gets its buffer flushed
+	const vector<Thread> &enabled = interpreter->getAllActiveThreads();
+	const vector<Thread> &runnable = interpreter->getRunnableThreads();
+	// decide what to do: switch thread or flush memory
+	if (Params::WMM == WMM_NONE || random.uniform() > Params::flushProb) {  
+		// switch thread
+		action.type = SWITCH_THREAD;
+		action.thread = runnable[random.below(runnable.size())];
+	} else {  																																				
+		// flush memory
+		if (Params::WMM == WMM_NONE) {
+			action.type = NO_ACTION;
+		} else if (Params::WMM == WMM_TSO) {
+			action.type = FLUSH_BUFFER;
+			action.thread = enabled[random.below(enabled.size())];
+		} else if (Params::WMM == WMM_PSO) {
+  		action.thread = enabled[random.below(enabled.size())];
+			// pick one of the addresses the thread has buffered stores to
+			const PSOBuffer *buffer = interpreter->thread_buffer_pso.find(action.thread);
+			if (buffer != NULL && !buffer->empty()) {
+				action.type = FLUSH_BUFFER;
+				psoIndex = random.below(buffer->getNumAddresses());
+				action.pso_var = GenericValue(buffer->getAddress(psoIndex));
+			} else {
+				action.type = NO_ACTION;
+			}
+		}
+		if (action.type == FLUSH_BUFFER && Params::coverage && delaysFlush(interpreter, action)) {
+			action.type = SWITCH_THREAD;
+			action.thread = runnable[random.below(runnable.size())];
+		}
+	}
+	return action;
+}
+
+// delaysFlush - Whether to keep the oldest store of the buffer the action
+// flushes a little longer.  A store reordered with few instructions in the
+// traces so far is kept with a probability of up to 1/2, so that the
+// instructions after it get reordered with it too.
+bool Scheduler::delaysFlush(const Interpreter* interpreter, const Action &action) {
+	int label;
+	if (Params::WMM == WMM_TSO) {
+		const TSOBuffer *buffer = interpreter->thread_buffer_tso.find(action.thread);
+		if (buffer == NULL || buffer->empty())
+			return false;
+		label = buffer->front().label;
+	} else {
+		label = interpreter->thread_buffer_pso.find(action.thread)->front(action.pso_var.PointerVal).label;
+	}
+	return random.uniform() < 1.0 / (2 + interpreter->getConstraints()->GetStoreCoverage(label));
+}
+
+//===----------------------------------------------------------------------===//
+// PREDICTIVE
+//
+
+// A reordering the run does not reach within this many decisions after the
+// store is given up, since the threads may be waiting for the store.
+static const unsigned MaxSteerSteps = 1000;
+
+// isHeld - Whether the store of the reordering is still buffered.
+bool Scheduler::isHeld(const Interpreter* interpreter) const {
+	if (Params::WMM == WMM_TSO) {
+		const TSOBuffer *buffer = interpreter->thread_buffer_tso.find(Thread(steerOwner));
+		return buffer != NULL && buffer->getNumFlushed() <= steerStore;
+	} else if (Params::WMM == WMM_PSO) {
+		const PSOBuffer *buffer = interpreter->thread_buffer_pso.find(Thread(steerOwner));
+		return buffer != NULL && buffer->getNumFlushed(steerAddr) <= steerStore;
+	}
+	return false;
+}
+
+// selectPredictive - The RANDOM scheduler, except that it keeps the store of
+// the reordering buffered once it has run, first runs its thread up to the
+// access, and then the other threads up to the read.
+Action Scheduler::selectPredictive(const Interpreter* interpreter) {
+	int curr = interpreter->getCurrThread().tid();
+	if (lastSwitched && interpreter->instr_info.isSharedAccessing) {
+		int label = interpreter->instr_info.label;
+		if (steerPhase == STEER_WAIT && label == target.Store &&
+				!interpreter->instr_info.isWriteOrRead) {
+			steerOwner = curr;
+			steerAddr = (void*)interpreter->instr_info.addr;
+			if (Params::WMM == WMM_TSO)
+				steerStore = interpreter->thread_buffer_tso.find(Thread(curr))->getNumStored() - 1;
+			else if (Params::WMM == WMM_PSO)
+				steerStore = interpreter->thread_buffer_pso.find(Thread(curr))->getNumStored(steerAddr) - 1;
+			steerPhase = Params::WMM == WMM_NONE ? STEER_NONE : STEER_OWNER;
+			steerSteps = 0;
+		} else if (steerPhase == STEER_OWNER && curr == steerOwner && label == target.Access) {
+			steerPhase = STEER_OTHERS;
+		} else if (steerPhase == STEER_OTHERS && curr != steerOwner && label == target.Read) {
+			steerPhase = STEER_NONE;
+		}
+	}
+	if ((steerPhase == STEER_OWNER || steerPhase == STEER_OTHERS) &&
+			(!isHeld(interpreter) || ++steerSteps > MaxSteerSteps))
+		steerPhase = STEER_NONE;
+
+	Action action = selectRandom(interpreter);
+	if (steerPhase == STEER_OWNER || steerPhase == STEER_OTHERS) {
+		bool flushesStore = false;
+		if (action.type == FLUSH_BUFFER && action.thread.tid() == steerOwner) {
+			if (Params::WMM == WMM_TSO)
+				flushesStore = interpreter->thread_buffer_tso.find(action.thread)->getNumFlushed() == steerStore;
+			else
+				flushesStore = action.pso_var.PointerVal == steerAddr &&
+					interpreter->thread_buffer_pso.find(action.thread)->getNumFlushed(steerAddr) == steerStore;
+		}
+		if (action.type == SWITCH_THREAD || flushesStore) {
+			const vector<Thread> &runnable = interpreter->getRunnableThreads();
+			vector<Thread> preferred;
+			for (unsigned i = 0; i < runnable.size(); ++i) {
+				bool owner = runnable[i].tid() == steerOwner;
+				if (owner == (steerPhase == STEER_OWNER))
+					preferred.push_back(runnable[i]);
+			}
+			action.type = SWITCH_THREAD;
+			if (!preferred.empty())
+				action.thread = preferred[random.below(preferred.size())];
+			else
+				action.thread = runnable[random.below(runnable.size())];
+		}
+	}
+	lastSwitched = action.type == SWITCH_THREAD;
+	return action;
+}
+
+//===----------------------------------------------------------------------===//
+// PCT
+//
+
+// highestPriority - The index of the entity with the highest priority; the
+// entities seen for the first time get a random one above the change points.
+unsigned Scheduler::highestPriority(const std::vector<ScheduleEntity> &entities) {
+	unsigned best = 0;
+	uint64_t bestPriority = 0;
+	for (unsigned k = 0; k < entities.size(); ++k) {
+		std::pair<std::map<ScheduleEntity, uint64_t>::iterator, bool> ins =
+			priorities.insert(std::make_pair(entities[k], 0));
+		if (ins.second)
+			ins.first->second = (uint64_t)Params::pctDepth + 1 + random.next();
+		if (k == 0 || ins.first->second > bestPriority) {
+			best = k;
+			bestPriority = ins.first->second;
+		}
+	}
+	return best;
+}
+
+Action Scheduler::selectPCT(const Interpreter* interpreter) {
+	// the thread that ran last waits in join_all or got through it
+	int curr = interpreter->getCurrThread().tid();
+	if (waiting.size() <= (unsigned)curr)
+		waiting.resize(curr + 1, 0);
+	waiting[curr] = interpreter->instr_info.isBlocked;
+
+	std::vector<ScheduleEntity> entities;
+	collectEntities(interpreter, waiting, entities);
+	++steps;
+	unsigned best = highestPriority(entities);
+	for (unsigned i = 0; i < changePoints.size(); ++i) {
+		if (changePoints[i] == steps) {
+			priorities[entities[best]] = i + 1;
+			best = highestPriority(entities);
+		}
+	}
+
+	// an entity that keeps running for longer than a whole trace should
+	// take spins on a flag that only a lower priority entity sets
+	if (entities[best] == lastRun) {
+		if (++runLength > Params::pctLength) {
+			priorities[entities[best]] = 0;
+			best = highestPriority(entities);
+			runLength = 1;
+		}
+	} else {
+		runLength = 1;
+	}
+	lastRun = entities[best];
+
+	return entityAction(interpreter, entities[best], psoIndex);
+}
@@ -15,13 +15,131 @@
 
 #include "Interpreter.h"
 #include "Action.h"
+#include "Predictor.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
 
 using namespace llvm;
 
+// Random - The pseudo random generator of one run (xorshift64*).  It is seeded
+// explicitly so that a run can be repeated, and it is much cheaper than rand().
+class Random {
+	uint64_t State;
+	public:
+	explicit Random(uint64_t seed = 1) { setSeed(seed); }
+	void setSeed(uint64_t seed) {
+		// the state must not be zero
+		State = seed * 0x9E3779B97F4A7C15ULL + 0x2545F4914F6CDD1DULL;
+		if (State == 0)
+			State = 1;
+	}
+	uint32_t next() {
+		State ^= State >> 12;
+		State ^= State << 25;
+		State ^= State >> 27;
+		return (uint32_t)((State * 0x2545F4914F6CDD1DULL) >> 32);
+	}
+	// below - a number in [0, n)
+	unsigned below(unsigned n) {
+		return (unsigned)(((uint64_t)next() * n) >> 32);
+	}
+	// uniform - a number in [0, 1]
+	double uniform() {
+		return (double)next() / 4294967295.0;
+	}
+};
+
+// ScheduleLog - A compact binary record of the actions of the scheduler,
+// enough to replay a run without making any random decision.
+//
+// The file starts with a magic and the seed of the run; then every action is
+// one byte, the action type in the low two bits and the thread number in the
+// upper six (63 if the number follows as a varint).  A PSO flush is followed by
+// the index of the flushed address among the buffered addresses of the thread.
+class ScheduleLog {
+	FILE *File;
+	bool Writing;
+	void putNumber(unsigned);
+	bool getNumber(unsigned &);
+	public:
+	ScheduleLog() : File(NULL), Writing(false) {}
+	~ScheduleLog() { close(); }
+	bool isWriting() const { return File != NULL && Writing; }
+	bool isReading() const { return File != NULL && !Writing; }
+	void create(const std::string &name, unsigned seed);
+	// open - Start replaying the given log and return the seed it was made with.
+	unsigned open(const std::string &name);
+	void close();
+	void write(const Action &action, unsigned psoIndex);
+	// read - The next action; PSO flushes only get their address index, which
+	// the caller resolves.  Returns false at the end of the log.
+	bool read(Action &action, unsigned &psoIndex);
+};
+
+// the context switches of the current run, and how many of them preempted a
+// thread that could have gone on; kept by the BOUNDED scheduler
+extern unsigned CSCounter;
+extern unsigned PreemptiveCSCounter;
+
 class Scheduler {
+	Random random;
+	ScheduleLog log;
+	unsigned psoIndex;   // address index of the last PSO flush chosen
+	bool exploring;      // the run is a trace of the DPOR exploration
+	bool bounding;       // the run is a schedule of the BOUNDED exploration
+	Thread rrThread;     // DBRR: the thread picked last
+
+	// PCT: every entity has a random priority and the highest one runs.  At
+	// the i-th change point the entity about to run drops to priority i, below
+	// all the initial ones.
+	std::map<ScheduleEntity, uint64_t> priorities;
+	std::vector<unsigned> changePoints;  // in the order of their priorities
+	unsigned steps;                      // decisions taken
+	ScheduleEntity lastRun;
+	unsigned runLength;                  // consecutive decisions for lastRun
+	std::vector<char> waiting;           // threads waiting in join_all
+
+	// PREDICTIVE: the reordering the run steers towards, and how far it got
+	enum {STEER_NONE, STEER_WAIT, STEER_OWNER, STEER_OTHERS} steerPhase;
+	Reordering target;
+	int steerOwner;         // the thread that ran the store
+	void *steerAddr;        // the address of the store
+	uint64_t steerStore;    // the number of the store in its buffer
+	unsigned steerSteps;    // decisions since the store
+	bool lastSwitched;      // the last action ran an instruction
 	public:
-	 Action selectAction(const Interpreter*) const;
-	 Action selectAction1(const Interpreter*) const;
+	// Scheduler - seed is the seed of the run, runNumber counts the runs of
+	// this process (lli-synth runs many) and tells the logs apart.
+	Scheduler(unsigned seed, unsigned runNumber);
+	~Scheduler();
+	Action selectAction(const Interpreter*);
+	Action selectAction1(const Interpreter*);
+	// getSeed - The seed the scheduler uses, after -seed and -replay-schedule.
+	static unsigned getSeed(unsigned runNumber);
+	// usesLog - Whether the runs are recorded or replayed, from the start of
+	// the program on.
+	static bool usesLog();
+	// collectEntities - The entities that can run, in thread order: the
+	// threads, except those waiting in join_all while another thread runs,
+	// and the non-empty store buffers.
+	static void collectEntities(const Interpreter*, const std::vector<char> &waiting,
+			std::vector<ScheduleEntity> &entities);
+	// entityAction - The action that runs an entity; psoIndex receives the
+	// address index of a PSO flush.
+	static Action entityAction(const Interpreter*, const ScheduleEntity &entity,
+			unsigned &psoIndex);
+	private:
+	Action decideAction(const Interpreter*);
+	Action replayAction(const Interpreter*);
+	Action selectRandom(const Interpreter*);
+	bool delaysFlush(const Interpreter*, const Action &action);
+	Action selectPredictive(const Interpreter*);
+	bool isHeld(const Interpreter*) const;
+	Action selectPCT(const Interpreter*);
+	unsigned highestPriority(const std::vector<ScheduleEntity> &entities);
 };
 
 #endif
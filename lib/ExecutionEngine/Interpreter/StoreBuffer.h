@@ -0,0 +1,211 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLI_STOREBUFFER_H
+#define LLI_STOREBUFFER_H
+
+#include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/Type.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/System/DataTypes.h"
+
+#include <deque>
+#include <vector>
+
+namespace llvm {
+
+	typedef struct {
+	  GenericValue pointer;
+	  GenericValue value;
+	  Type* type;
+	  int label;     // label_instr of the store
+	} tso_buff_elem;
+
+	// TSOBuffer - The FIFO store buffer of one thread under TSO.
+	//
+	// The stores live in a ring whose capacity is a power of two and is doubled
+	// when it is full.  Every store gets a sequence number, and the store with
+	// number N sits at Ring[N & Mask].  Newest maps an address to the number of
+	// the youngest buffered store to it, so store-to-load forwarding does not
+	// have to walk the buffer.
+	//
+	class TSOBuffer {
+		std::vector<tso_buff_elem> Ring;
+		uint64_t Mask;
+		uint64_t Head;    // number of the oldest buffered store
+		uint64_t Tail;    // number the next store will get
+		DenseMap<void*, uint64_t> Newest;
+
+		void grow() {
+			std::vector<tso_buff_elem> NewRing(Ring.size() * 2);
+			uint64_t NewMask = NewRing.size() - 1;
+			for (uint64_t N = Head; N != Tail; ++N)
+				NewRing[N & NewMask] = Ring[N & Mask];
+			Ring.swap(NewRing);
+			Mask = NewMask;
+		}
+
+		public:
+		TSOBuffer() : Ring(16), Mask(15), Head(0), Tail(0) {}
+
+		bool empty() const { return Head == Tail; }
+		unsigned size() const { return Tail - Head; }
+		// getNumStored/getNumFlushed - The stores buffered and flushed so far;
+		// the N-th store is still buffered while getNumFlushed() <= N.
+		uint64_t getNumStored() const { return Tail; }
+		uint64_t getNumFlushed() const { return Head; }
+
+		// push_back - Buffer a store; it becomes the forwarding source for its
+		// address.
+		void push_back(const tso_buff_elem &Elem) {
+			if (Tail - Head == Ring.size())
+				grow();
+			Ring[Tail & Mask] = Elem;
+			Newest[Elem.pointer.PointerVal] = Tail;
+			++Tail;
+		}
+
+		// front - The oldest store, the next one to reach memory.
+		const tso_buff_elem &front() const { return Ring[Head & Mask]; }
+
+		void pop_front() {
+			DenseMap<void*, uint64_t>::iterator It =
+				Newest.find(Ring[Head & Mask].pointer.PointerVal);
+			if (It != Newest.end() && It->second == Head)
+				Newest.erase(It);
+			++Head;
+		}
+
+		// findNewest - The youngest buffered store to Addr, or NULL if the
+		// buffer holds no store to Addr.
+		const tso_buff_elem *findNewest(void *Addr) const {
+			DenseMap<void*, uint64_t>::const_iterator It = Newest.find(Addr);
+			if (It == Newest.end())
+				return 0;
+			return &Ring[It->second & Mask];
+		}
+	};
+
+	typedef struct {
+	  GenericValue value;
+	  Type* type;
+	  int label;     // label_instr of the store
+	} pso_buff_elem;
+
+	// PSOBuffer - The store buffers of one thread under PSO, one FIFO queue per
+	// address.
+	//
+	// Queues are created on the first store to an address and then kept, so an
+	// address maps to the same queue for the whole run.  The queues that are
+	// not empty are also listed densely in NonEmpty, which lets the scheduler
+	// pick a random buffered address, and lets fences drain the buffers,
+	// without looking at empty queues.
+	//
+	class PSOBuffer {
+		struct Queue {
+			void *Addr;
+			std::deque<pso_buff_elem> Elems;
+			unsigned Pos;      // index in NonEmpty while Elems is not empty
+			uint64_t Flushed;  // stores popped so far
+		};
+		std::vector<Queue> Queues;
+		DenseMap<void*, unsigned> QueueOf;
+		std::vector<unsigned> NonEmpty;
+
+		Queue *find(void *Addr) {
+			DenseMap<void*, unsigned>::iterator It = QueueOf.find(Addr);
+			return It == QueueOf.end() ? 0 : &Queues[It->second];
+		}
+		const Queue *find(void *Addr) const {
+			DenseMap<void*, unsigned>::const_iterator It = QueueOf.find(Addr);
+			return It == QueueOf.end() ? 0 : &Queues[It->second];
+		}
+
+		public:
+		// empty - Whether no address has a buffered store.
+		bool empty() const { return NonEmpty.empty(); }
+		bool empty(void *Addr) const {
+			const Queue *Q = find(Addr);
+			return Q == 0 || Q->Elems.empty();
+		}
+		// size - The number of buffered stores to Addr.
+		unsigned size(void *Addr) const {
+			const Queue *Q = find(Addr);
+			return Q == 0 ? 0 : Q->Elems.size();
+		}
+
+		// getNumStored/getNumFlushed - The stores to Addr buffered and flushed
+		// so far, as for TSOBuffer.
+		uint64_t getNumFlushed(void *Addr) const {
+			const Queue *Q = find(Addr);
+			return Q == 0 ? 0 : Q->Flushed;
+		}
+		uint64_t getNumStored(void *Addr) const {
+			const Queue *Q = find(Addr);
+			return Q == 0 ? 0 : Q->Flushed + Q->Elems.size();
+		}
+
+		// getNumAddresses/getAddress - The addresses with buffered stores.
+		unsigned getNumAddresses() const { return NonEmpty.size(); }
+		void *getAddress(unsigned i) const { return Queues[NonEmpty[i]].Addr; }
+
+		void push_back(void *Addr, const GenericValue &Value, Type *Ty, int Label) {
+			std::pair<DenseMap<void*, unsigned>::iterator, bool> Ins =
+				QueueOf.insert(std::make_pair(Addr, (unsigned)Queues.size()));
+			if (Ins.second) {
+				Queues.push_back(Queue());
+				Queues.back().Addr = Addr;
+				Queues.back().Flushed = 0;
+			}
+			unsigned Idx = Ins.first->second;
+			Queue &Q = Queues[Idx];
+			if (Q.Elems.empty()) {
+				Q.Pos = NonEmpty.size();
+				NonEmpty.push_back(Idx);
+			}
+			pso_buff_elem Elem;
+			Elem.value = Value;
+			Elem.type = Ty;
+			Elem.label = Label;
+			Q.Elems.push_back(Elem);
+		}
+
+		// findNewest - The youngest buffered store to Addr, or NULL.
+		const pso_buff_elem *findNewest(void *Addr) const {
+			const Queue *Q = find(Addr);
+			if (Q == 0 || Q->Elems.empty())
+				return 0;
+			return &Q->Elems.back();
+		}
+
+		// front - The oldest buffered store to Addr, which must not be empty.
+		const pso_buff_elem &front(void *Addr) const {
+			return find(Addr)->Elems.front();
+		}
+
+		void pop_front(void *Addr) {
+			Queue &Q = *find(Addr);
+			Q.Elems.pop_front();
+			++Q.Flushed;
+			if (Q.Elems.empty()) {
+				// swap the last non-empty queue into the vacated position
+				unsigned Last = NonEmpty.back();
+				NonEmpty[Q.Pos] = Last;
+				Queues[Last].Pos = Q.Pos;
+				NonEmpty.pop_back();
+			}
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,128 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "TraceChecker.h"
+#include "CheckTrace.h"
+#include "Params.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+
+using namespace llvm;
+
+TraceChecker::TraceChecker(unsigned Depth) : Stopping(false) {
+	ASSERT(Depth > 0, "the checker needs a trace to check");
+	for (unsigned i = 0; i < Depth; ++i)
+		Free.push_back(std::make_pair(new History(), new RWHistory()));
+	pthread_mutex_init(&Lock, 0);
+	pthread_cond_init(&Queued, 0);
+	pthread_cond_init(&Checked, 0);
+	if (pthread_create(&Thread, 0, start, this) != 0)
+		ASSERT(0, "cannot start the checker thread");
+}
+
+TraceChecker::~TraceChecker() {
+	pthread_mutex_lock(&Lock);
+	Stopping = true;
+	pthread_cond_signal(&Queued);
+	pthread_mutex_unlock(&Lock);
+	pthread_join(Thread, 0);
+	pthread_cond_destroy(&Checked);
+	pthread_cond_destroy(&Queued);
+	pthread_mutex_destroy(&Lock);
+	for (unsigned i = 0; i < Free.size(); ++i) {
+		delete Free[i].first;
+		delete Free[i].second;
+	}
+}
+
+void TraceChecker::submit(History *&history, RWHistory *&rwHistory,
+		int nextThreadNum) {
+	Job J;
+	J.Hist = history;
+	J.RWHist = rwHistory;
+	J.NextThreadNum = nextThreadNum;
+	pthread_mutex_lock(&Lock);
+	while (Free.empty())
+		pthread_cond_wait(&Checked, &Lock);
+	history = Free.back().first;
+	rwHistory = Free.back().second;
+	Free.pop_back();
+	Jobs.push_back(J);
+	pthread_cond_signal(&Queued);
+	pthread_mutex_unlock(&Lock);
+}
+
+void TraceChecker::takeResults(std::vector<Result> &results, bool wait) {
+	pthread_mutex_lock(&Lock);
+	while (wait && !Jobs.empty())
+		pthread_cond_wait(&Checked, &Lock);
+	results.swap(Done);
+	Done.clear();
+	pthread_mutex_unlock(&Lock);
+}
+
+void *TraceChecker::start(void *arg) {
+	((TraceChecker *)arg)->checkAll();
+	return 0;
+}
+
+void TraceChecker::checkAll() {
+	pthread_mutex_lock(&Lock);
+	while (true) {
+		while (Jobs.empty() && !Stopping)
+			pthread_cond_wait(&Queued, &Lock);
+		if (Jobs.empty())
+			break;
+		Job J = Jobs.front();
+		pthread_mutex_unlock(&Lock);
+
+		Result R;
+		check(J, R);
+		J.Hist->clear();
+		J.RWHist->clear();
+
+		pthread_mutex_lock(&Lock);
+		Jobs.pop_front();
+		Free.push_back(std::make_pair(J.Hist, J.RWHist));
+		Done.push_back(R);
+		pthread_cond_broadcast(&Checked);
+	}
+	pthread_mutex_unlock(&Lock);
+}
+
+// threadClock - The processor time of the calling thread, in clock() units.
+// clock() is that of the process and so would count the interpreter running
+// the next trace meanwhile as well.
+static clock_t threadClock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (clock_t)(ts.tv_sec * (double)CLOCKS_PER_SEC
+			+ ts.tv_nsec * (CLOCKS_PER_SEC / 1e9));
+}
+
+// check - What Interpreter::run does at the end of a trace of lli-synth.
+void TraceChecker::check(const Job &J, Result &R) {
+	clock_t start = threadClock();
+	J.RWHist->FindSharedRW();
+	if (Params::coverage)
+		Constr.Reordered(J.RWHist, J.NextThreadNum, R.Covered);
+	R.Status = CheckTrace::checkHistory(J.Hist, J.NextThreadNum);
+	R.Lits = 0;
+	if (R.Status == 253) {
+		J.RWHist->PrintSharedRW();
+		Constr.Calculate(J.RWHist, J.NextThreadNum);
+		R.Pairs = Constr.GetClausePairs();
+		R.Lits = Constr.GetLitSingleNumber();
+		if (R.Lits == 0)
+			J.RWHist->PrintSharedRW();
+	}
+	R.Time = threadClock() - start;
+}
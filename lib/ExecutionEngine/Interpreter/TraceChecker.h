@@ -0,0 +1,86 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The class was added for DFENCE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLI_TRACECHECKER_H
+#define LLI_TRACECHECKER_H
+
+#include "History.h"
+#include "RWHistory.h"
+#include "Constraints.h"
+
+#include <ctime>
+#include <deque>
+#include <set>
+#include <vector>
+#include <pthread.h>
+
+namespace llvm {
+
+	// TraceChecker - The end of a trace, on a thread of its own (lli-synth
+	// -pipeline): the shared accesses, the reordered pairs, the check of the
+	// specification and, for a violation, the clause.  The interpreter hands
+	// the recorded trace over and runs the next one meanwhile.
+	//
+	// The checker owns Depth pairs of a History and a RWHistory besides the
+	// one the interpreter records into; submit() swaps the finished pair for
+	// an empty one and waits while all of them are being checked, so at most
+	// Depth traces are kept however far the interpreter is ahead.
+	//
+	class TraceChecker {
+		public:
+		// Result - What the check of a trace found out.
+		struct Result {
+			int Status;       // 253 for a violation, as Interpreter::ExitStatus
+			int Lits;         // the literals of its clause
+			ReorderedPairs Pairs;                  // the clause
+			std::set<tso_constraint_pair> Covered; // the pairs the trace reordered
+			clock_t Time;     // the processor time of the checker thread for it
+		};
+
+		private:
+		struct Job {
+			History *Hist;
+			RWHistory *RWHist;
+			int NextThreadNum;
+		};
+
+		pthread_t Thread;
+		pthread_mutex_t Lock;
+		pthread_cond_t Queued;    // a trace was handed over, or the checker stops
+		pthread_cond_t Checked;   // a trace was checked
+		std::deque<Job> Jobs;     // the front one is being checked
+		std::vector<std::pair<History*, RWHistory*> > Free;
+		std::vector<Result> Done;
+		bool Stopping;
+		Constraints Constr;       // for the clauses, apart from those of lli-synth
+
+		static void *start(void *arg);
+		void checkAll();
+		void check(const Job &J, Result &R);
+
+		public:
+		explicit TraceChecker(unsigned Depth);
+		// ~TraceChecker - Check what was handed over, then end the thread.
+		~TraceChecker();
+
+		// submit - Hand a finished trace over; history and rwHistory are an
+		// empty pair afterwards.
+		void submit(History *&history, RWHistory *&rwHistory, int nextThreadNum);
+
+		// takeResults - The results of the traces checked since the last call,
+		// in the order they were handed over; with wait, of all of them.
+		void takeResults(std::vector<Result> &results, bool wait);
+	};
+
+}
+
+#endif
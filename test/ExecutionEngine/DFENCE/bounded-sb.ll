@@ -0,0 +1,58 @@
+; Store buffering under TSO needs one preemption: BOUNDED finds it at bound 1,
+; and once both store-load fences are in, exhausts bound 2 without a violation.
+; RUN: llvm-as %s -o %t.bc
+; RUN: env CONFDIR=%S/Inputs/tso-bounded/ lli-synth -force-interpreter %t.bc |& FileCheck %s
+
+; CHECK: BOUNDED: bound 0 exhausted
+; CHECK: BOUNDED: violation found at bound 1
+; CHECK: Round 3
+; CHECK: BOUNDED: bound 2 exhausted {{.*}} (exploration complete)
+; CHECK: find 0 buggy traces
+; CHECK: There are 2 fences in total!
+; CHECK: store_load_fence
+; CHECK: In function: main
+; CHECK: store_load_fence
+; CHECK: In function: t2
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+
+; Store buffering: r1 == 0 && r2 == 0 is forbidden under SC, and a violation
+; (the cas32 on a null pointer) under TSO.
+@x = global i32 0
+@y = global i32 0
+@r1 = global i32 1
+@r2 = global i32 1
+
+declare void @spawn_thread(void ()*)
+declare void @join_all()
+declare void @membar_sl(...)
+declare i32 @cas32(i32*, i32, i32)
+
+define void @t2() {
+entry:
+  store i32 1, i32* @y
+  %b = load i32* @x
+  store i32 %b, i32* @r2
+  call void (...)* @membar_sl()
+  ret void
+}
+
+define i32 @main() {
+entry:
+  call void @spawn_thread(void ()* @t2)
+  store i32 1, i32* @x
+  %a = load i32* @y
+  store i32 %a, i32* @r1
+  call void (...)* @membar_sl()
+  call void @join_all()
+  %v1 = load i32* @r1
+  %v2 = load i32* @r2
+  %o = or i32 %v1, %v2
+  %bad = icmp eq i32 %o, 0
+  br i1 %bad, label %fail, label %ok
+fail:
+  %c = call i32 @cas32(i32* null, i32 0, i32 0)
+  br label %ok
+ok:
+  ret i32 0
+}
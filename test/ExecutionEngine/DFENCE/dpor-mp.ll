@@ -0,0 +1,57 @@
+; Message passing breaks under PSO only: DPOR synthesizes a store-store fence
+; between the two stores of main under PSO, and no fence under TSO.
+; RUN: llvm-as %s -o %t.pso.bc
+; RUN: llvm-as %s -o %t.tso.bc
+; RUN: env CONFDIR=%S/Inputs/pso-dpor/ lli-synth -force-interpreter -try 500 %t.pso.bc |& FileCheck %s -check-prefix=PSO
+; RUN: env CONFDIR=%S/Inputs/tso-dpor/ lli-synth -force-interpreter -try 500 %t.tso.bc |& FileCheck %s -check-prefix=TSO
+
+; PSO: find {{[1-9][0-9]*}} buggy traces
+; PSO: There are 1 fences in total!
+; PSO: store_store_fence
+; PSO: In function: main
+; TSO: find 0 buggy traces
+; TSO: There are 0 fences in total!
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+
+; r1 == 1 && r2 == 0 is forbidden under SC and TSO, and a violation (the
+; cas32 on a null pointer) under PSO.
+@x = global i32 0
+@y = global i32 0
+@r1 = global i32 0
+@r2 = global i32 1
+
+declare void @spawn_thread(void ()*)
+declare void @join_all()
+declare void @membar_sl(...)
+declare i32 @cas32(i32*, i32, i32)
+
+define void @t2() {
+entry:
+  %a = load i32* @y
+  %b = load i32* @x
+  store i32 %a, i32* @r1
+  store i32 %b, i32* @r2
+  call void (...)* @membar_sl()
+  ret void
+}
+
+define i32 @main() {
+entry:
+  call void @spawn_thread(void ()* @t2)
+  store i32 1, i32* @x
+  store i32 1, i32* @y
+  call void (...)* @membar_sl()
+  call void @join_all()
+  %v1 = load i32* @r1
+  %v2 = load i32* @r2
+  %ok1 = icmp eq i32 %v1, 1
+  %ok2 = icmp eq i32 %v2, 0
+  %bad = and i1 %ok1, %ok2
+  br i1 %bad, label %fail, label %ok
+fail:
+  %c = call i32 @cas32(i32* null, i32 0, i32 0)
+  br label %ok
+ok:
+  ret i32 0
+}
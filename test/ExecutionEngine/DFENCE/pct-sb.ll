@@ -0,0 +1,50 @@
+; PCT with a fixed seed finds the store buffering violation under TSO.
+; RUN: llvm-as %s -o %t.bc
+; RUN: env CONFDIR=%S/Inputs/tso-pct/ lli-synth -force-interpreter -try 200 -seed 7 %t.bc |& FileCheck %s
+
+; CHECK: Scheduler: PCT
+; CHECK: Try 200 times, find {{[1-9][0-9]*}} buggy traces
+; CHECK: store_load_fence
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+
+; Store buffering: r1 == 0 && r2 == 0 is forbidden under SC, and a violation
+; (the cas32 on a null pointer) under TSO.
+@x = global i32 0
+@y = global i32 0
+@r1 = global i32 1
+@r2 = global i32 1
+
+declare void @spawn_thread(void ()*)
+declare void @join_all()
+declare void @membar_sl(...)
+declare i32 @cas32(i32*, i32, i32)
+
+define void @t2() {
+entry:
+  store i32 1, i32* @y
+  %b = load i32* @x
+  store i32 %b, i32* @r2
+  call void (...)* @membar_sl()
+  ret void
+}
+
+define i32 @main() {
+entry:
+  call void @spawn_thread(void ()* @t2)
+  store i32 1, i32* @x
+  %a = load i32* @y
+  store i32 %a, i32* @r1
+  call void (...)* @membar_sl()
+  call void @join_all()
+  %v1 = load i32* @r1
+  %v2 = load i32* @r2
+  %o = or i32 %v1, %v2
+  %bad = icmp eq i32 %o, 0
+  br i1 %bad, label %fail, label %ok
+fail:
+  %c = call i32 @cas32(i32* null, i32 0, i32 0)
+  br label %ok
+ok:
+  ret i32 0
+}
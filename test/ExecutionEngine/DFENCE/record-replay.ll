@@ -0,0 +1,69 @@
+; The same -seed records the same schedule, and replaying a recorded schedule
+; with -replay-schedule gives the same traces; all three runs synthesize the
+; same fences. Each round writes one schedule file per trace: %t.a.sched for
+; the first, %t.a.sched.100 for the last of the two rounds.
+; RUN: llvm-as %s -o %t.a.bc
+; RUN: llvm-as %s -o %t.b.bc
+; RUN: llvm-as %s -o %t.c.bc
+; RUN: env CONFDIR=%S/Inputs/tso-random/ lli-synth -force-interpreter -try 50 \
+; RUN:   -seed 7 -record-schedule %t.a.sched %t.a.bc >& %t.a.out
+; RUN: env CONFDIR=%S/Inputs/tso-random/ lli-synth -force-interpreter -try 50 \
+; RUN:   -seed 7 -record-schedule %t.b.sched %t.b.bc >& %t.b.out
+; RUN: env CONFDIR=%S/Inputs/tso-random/ lli-synth -force-interpreter -try 50 \
+; RUN:   -replay-schedule %t.a.sched %t.c.bc >& %t.c.out
+; RUN: cmp %t.a.sched %t.b.sched
+; RUN: cmp %t.a.sched.100 %t.b.sched.100
+; RUN: grep -v -e Interp: -e Checking: -e Solving: -e Verify: %t.a.out > %t.a.trace
+; RUN: grep -v -e Interp: -e Checking: -e Solving: -e Verify: %t.b.out > %t.b.trace
+; RUN: grep -v -e Interp: -e Checking: -e Solving: -e Verify: %t.c.out > %t.c.trace
+; RUN: diff %t.a.trace %t.b.trace
+; RUN: diff %t.a.trace %t.c.trace
+; RUN: grep -v ModuleID %t.a.fixed.ll > %t.a.fences
+; RUN: grep -v ModuleID %t.b.fixed.ll > %t.b.fences
+; RUN: grep -v ModuleID %t.c.fixed.ll > %t.c.fences
+; RUN: diff %t.a.fences %t.b.fences
+; RUN: diff %t.a.fences %t.c.fences
+; RUN: grep {There are 2 fences in total} %t.a.out
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+
+; Store buffering: r1 == 0 && r2 == 0 is forbidden under SC, and a violation
+; (the cas32 on a null pointer) under TSO.
+@x = global i32 0
+@y = global i32 0
+@r1 = global i32 1
+@r2 = global i32 1
+
+declare void @spawn_thread(void ()*)
+declare void @join_all()
+declare void @membar_sl(...)
+declare i32 @cas32(i32*, i32, i32)
+
+define void @t2() {
+entry:
+  store i32 1, i32* @y
+  %b = load i32* @x
+  store i32 %b, i32* @r2
+  call void (...)* @membar_sl()
+  ret void
+}
+
+define i32 @main() {
+entry:
+  call void @spawn_thread(void ()* @t2)
+  store i32 1, i32* @x
+  %a = load i32* @y
+  store i32 %a, i32* @r1
+  call void (...)* @membar_sl()
+  call void @join_all()
+  %v1 = load i32* @r1
+  %v2 = load i32* @r2
+  %o = or i32 %v1, %v2
+  %bad = icmp eq i32 %o, 0
+  br i1 %bad, label %fail, label %ok
+fail:
+  %c = call i32 @cas32(i32* null, i32 0, i32 0)
+  br label %ok
+ok:
+  ret i32 0
+}
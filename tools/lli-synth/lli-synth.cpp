@@ -19,6 +19,7 @@
 #include "llvm/Module.h"
 #include "llvm/PassManager.h"
 #include "llvm/Type.h"
+#include "llvm/Assembly/Parser.h"
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/CodeGen/LinkAllCodegenComponents.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
@@ -35,13 +36,32 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/System/Process.h"
 #include "llvm/System/Signals.h"
+#include "llvm/System/Threading.h"
 #include "llvm/Target/TargetSelect.h"
 #include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <sstream>
 #include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "../../lib/ExecutionEngine/Interpreter/Interpreter.h"
 #include "../../lib/ExecutionEngine/Interpreter/Constraints.h"
 #include "../../lib/ExecutionEngine/Interpreter/Params.h"
+#include "../../lib/ExecutionEngine/Interpreter/DPOR.h"
+#include "../../lib/ExecutionEngine/Interpreter/Predictor.h"
+#include "../../lib/ExecutionEngine/Interpreter/ContextBound.h"
+#include "../../lib/ExecutionEngine/Interpreter/Scheduler.h"
+#include "../../lib/ExecutionEngine/Interpreter/TraceChecker.h"
 
 using namespace llvm;
 
@@ -57,6 +77,31 @@ namespace {
   cl::list<std::string>
   InputArgv(cl::ConsumeAfter, cl::desc("<program arguments>..."));
 
+  cl::opt<unsigned> Jobs("j",
+               cl::desc("Run the traces of each round in this many forked workers"),
+               cl::value_desc("N"), cl::init(1));
+
+  cl::opt<unsigned> Threads("threads",
+               cl::desc("Run the traces of each round on this many interpreters in threads"),
+               cl::value_desc("N"), cl::init(1));
+
+  cl::opt<unsigned> Pipeline("pipeline",
+               cl::desc("Check the traces on another thread, with at most N of them waiting"),
+               cl::value_desc("N"), cl::init(0));
+
+  cl::opt<std::string> Listen("listen",
+               cl::desc("Run the traces of each round in workers that connect to this "
+                        "Unix socket path or host:port"),
+               cl::value_desc("address"));
+
+  cl::opt<unsigned> RemoteWorkers("workers",
+               cl::desc("The number of workers -listen waits for"),
+               cl::value_desc("N"), cl::init(1));
+
+  cl::opt<std::string> Connect("connect",
+               cl::desc("Run traces for the lli-synth that listens at this address"),
+               cl::value_desc("address"));
+
   cl::opt<bool> ForceInterpreter("force-interpreter",
                                  cl::desc("Force interpretation: disable JIT"),
                                  cl::init(false));
@@ -112,8 +157,15 @@ namespace {
 }
 
 static ExecutionEngine *EE = 0;
+// InputArgv starts with the name of the program
+static bool HasProgramName = false;
+// interpreters of -threads or the checker of -pipeline run: a trace that exits
+// must leave LLVM to them
+static volatile bool ThreadsRunning = false;
 
 static void do_shutdown() {
+  if (ThreadsRunning)
+    return;
   delete EE;
   llvm_shutdown();
 }
@@ -123,15 +175,118 @@ std::string ErrorMsg;
 extern Constraints constraintsHandler;
 unsigned total_traces = 0;
 unsigned buggy_traces = 0;
-clock_t timeofInterp, timeofSolving, timeofVerify;
-extern clock_t timeofChecking;
+unsigned livelock_traces = 0;
+clock_t timeofInterp, timeofSolving, timeofVerify, timeofChecking;
 
-int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
-									LLVMContext &Context, bool toSolver) { 
-   double average_lits = 0.0;
-   double accumul_lits = 0.0;
+// the pipe a worker of -j sends its results to, -1 in the process that solves
+static int WorkerPipe = -1;
+
+// WriteAll - Write all of text to fd, or exit.
+static void WriteAll(int fd, const std::string &text) {
+	const char *p = text.data();
+	size_t left = text.size();
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror("lli-synth: write");
+			exit(1);
+		}
+		p += n;
+		left -= n;
+	}
+}
+
+// A worker reports one line per message:
+//   C n st ld sl ...   the reordered pairs of the clause of a buggy trace
+//   V st ld traces     the traces that newly reordered a pair (coverage)
+//   S traces livelocks the traces it ran, sent last
+//   X status           a remote worker ended with this error (-connect)
+static void SendToParent(const std::string &line) {
+	WriteAll(WorkerPipe, line);
+}
+
+static void SendClause(const ReorderedPairs &pairs) {
+	std::ostringstream line;
+	line << "C " << pairs.size();
+	for (unsigned i = 0; i < pairs.size(); ++i)
+		line << ' ' << pairs[i].first.first << ' ' << pairs[i].first.second
+		     << ' ' << pairs[i].second;
+	line << '\n';
+	SendToParent(line.str());
+}
+
+// TakeClause - Count a buggy trace found elsewhere and add its clause to the
+// solver, or in a worker of -j send it on; returns false if the clause is
+// empty.
+static bool TakeClause(const ReorderedPairs &pairs) {
+	constraintsHandler.SetClause(pairs);
+	buggy_traces++;
+	if (constraintsHandler.GetLitSingleNumber() == 0)
+		return false;
+	if (WorkerPipe >= 0)
+		SendClause(pairs);
+	else
+		constraintsHandler.AddToSolver();
+	return true;
+}
+
+// TakeChecked - Take over what the checker of -pipeline found out about the
+// traces handed over, as InterpretRun does after a trace; with wait, about
+// all of them.
+static void TakeChecked(TraceChecker *checker, bool wait) {
+	std::vector<TraceChecker::Result> results;
+	checker->takeResults(results, wait);
+	for (unsigned i = 0; i < results.size(); ++i) {
+		const TraceChecker::Result &R = results[i];
+		timeofChecking += R.Time;
+		for (std::set<tso_constraint_pair>::const_iterator it = R.Covered.begin();
+		     it != R.Covered.end(); ++it)
+			constraintsHandler.AddCoverage(*it, 1);
+		if (R.Status != 253)
+			continue;
+		// as the interpreter exits on a violation without constraints
+		if (R.Lits == 0)
+			exit(255);
+		if (!TakeClause(R.Pairs))
+			exit(254);
+	}
+}
+
+// ReceiveFromWorker - Take over one message of a worker.  Returns false for a
+// clause without literals, on which a serial run exits with 254.
+static bool ReceiveFromWorker(const std::string &line, bool &done) {
+	std::istringstream in(line);
+	char kind = 0;
+	in >> kind;
+	if (kind == 'C') {
+		unsigned n = 0;
+		in >> n;
+		ReorderedPairs pairs;
+		for (unsigned i = 0; i < n; ++i) {
+			int st, ld, sl;
+			in >> st >> ld >> sl;
+			pairs.push_back(ReorderedPair(tso_constraint_pair(st, ld), sl != 0));
+		}
+		if (!TakeClause(pairs))
+			return false;
+	} else if (kind == 'V') {
+		int st, ld, traces;
+		in >> st >> ld >> traces;
+		constraintsHandler.AddCoverage(tso_constraint_pair(st, ld), traces);
+	} else if (kind == 'S') {
+		unsigned traces, livelocks;
+		in >> traces >> livelocks;
+		total_traces += traces;
+		livelock_traces += livelocks;
+		done = true;
+	}
+	return true;
+}
 
-   while ((total_traces < RetryTime)) {// || (average_lits >= 5.0 * buggy_traces)) {
+// CreateEngine - A new execution engine for Mod, as the options ask.
+static ExecutionEngine *CreateEngine(Module *Mod, char **argv) {
   	EngineBuilder builder(Mod);
   	builder.setMArch(MArch);
   	builder.setMCPU(MCPU);
@@ -149,7 +304,7 @@ int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
    	switch (OptLevel) {
 	    default:
 	    	errs() << argv[0] << ": invalid optimization level.\n";
-    	    return 1;
+    	    exit(1);
      	    case ' ': break;
   	    case '0': OLvl = CodeGenOpt::None; break;
   	    case '1': OLvl = CodeGenOpt::Less; break;
@@ -159,8 +314,8 @@ int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
 
  	builder.setOptLevel(OLvl);
 
-  	EE = builder.create();
-  	if (!EE) {
+  	ExecutionEngine *E = builder.create();
+  	if (!E) {
     	  if (!ErrorMsg.empty())
       	     errs() << argv[0] << ": error creating EE: " << ErrorMsg << "\n";
       	  else
@@ -168,9 +323,16 @@ int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
     	exit(1);
   	}
 
-  	EE->RegisterJITEventListener(createOProfileJITEventListener());
+  	E->RegisterJITEventListener(createOProfileJITEventListener());
 
-  	EE->DisableLazyCompilation(NoLazyCompilation);
+  	E->DisableLazyCompilation(NoLazyCompilation);
+	return E;
+}
+
+// SetProgramArgs - Put the name of the program before its arguments.
+static void SetProgramArgs() {
+	if (HasProgramName)
+		return;
 
   	// If the user specifically requested an argv[0] to pass into the program,
   	// do it now.
@@ -180,12 +342,795 @@ int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
 	else {
     	  // Otherwise, if there is a .bc suffix on the executable strip it off, it
     	  // might confuse the program.
-    	  if (InputFile.rfind(".bc") == InputFile.length() - 3)
+    	  if (InputFile.length() >= 3 &&
+		  InputFile.rfind(".bc") == InputFile.length() - 3)
       	    InputFile.erase(InputFile.length() - 3);
   	}
 
   	// Add the module's name to the start of the vector of arguments to main().
   	InputArgv.insert(InputArgv.begin(), InputFile);
+	HasProgramName = true;
+}
+
+int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
+                 LLVMContext &Context, bool toSolver);
+
+// RunShare - Run share traces of a round as a worker, from run first + 1 on,
+// and send what they covered and how many there were to WorkerPipe.
+static int RunShare(Module* Mod, unsigned first, unsigned share, char** argv,
+                    char* const* envp, LLVMContext &Context, bool toSolver) {
+	Interpreter::skipRuns(first);
+	std::map<tso_constraint_pair, int> covered = constraintsHandler.GetCoverageMap();
+	int ret = InterpretRun(Mod, share, argv, envp, Context, toSolver);
+	const std::map<tso_constraint_pair, int> &now = constraintsHandler.GetCoverageMap();
+	for (std::map<tso_constraint_pair, int>::const_iterator it = now.begin();
+	     it != now.end(); ++it) {
+		int traces = it->second - covered[it->first];
+		if (traces == 0)
+			continue;
+		std::ostringstream line;
+		line << "V " << it->first.first << ' ' << it->first.second << ' '
+		     << traces << '\n';
+		SendToParent(line.str());
+	}
+	std::ostringstream line;
+	line << "S " << total_traces << ' ' << livelock_traces << '\n';
+	SendToParent(line.str());
+	close(WorkerPipe);
+	return ret;
+}
+
+// StopWorkers - Kill and reap the workers of -j that are still running.
+static void StopWorkers(const std::vector<pid_t> &pids, const std::vector<int> &fds) {
+	for (unsigned w = 0; w < fds.size(); ++w) {
+		if (fds[w] < 0)
+			continue;
+		kill(pids[w], SIGKILL);
+		waitpid(pids[w], 0, 0);
+	}
+}
+
+// RunWorkers - Run the traces of a round in -j forked workers, each with its
+// share of them and its own block of run numbers, and so of seeds.  The
+// workers start from the module as it is now and send back the clauses of
+// their buggy traces, which go into the solver here.  A worker that exits
+// with an error (e.g. 255, a violation without constraints) ends lli-synth
+// with the same status.
+static int RunWorkers(Module* Mod, int RetryTime, char** argv, char* const* envp,
+                      LLVMContext &Context, bool toSolver) {
+	std::vector<pid_t> pids;
+	std::vector<int> fds;
+	unsigned first = 0;
+
+	// what is buffered would be printed again by every worker
+	cout.flush();
+	fflush(stdout);
+	outs().flush();
+	for (unsigned w = 0; w < Jobs; ++w) {
+		unsigned share = RetryTime / Jobs + (w < RetryTime % Jobs ? 1 : 0);
+		if (share == 0)
+			continue;
+		int fd[2];
+		if (pipe(fd) != 0) {
+			perror("lli-synth: pipe");
+			exit(1);
+		}
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("lli-synth: fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			for (unsigned i = 0; i < fds.size(); ++i)
+				close(fds[i]);
+			close(fd[0]);
+			WorkerPipe = fd[1];
+			exit(RunShare(Mod, first, share, argv, envp, Context, toSolver));
+		}
+		close(fd[1]);
+		pids.push_back(pid);
+		fds.push_back(fd[0]);
+		first += share;
+	}
+	// the next round numbers its runs after those of the workers
+	Interpreter::skipRuns(first);
+
+	std::vector<std::string> pending(fds.size());
+	std::vector<bool> done(fds.size(), false);
+	unsigned running = fds.size();
+	while (running > 0) {
+		std::vector<struct pollfd> polled;
+		std::vector<unsigned> worker;
+		for (unsigned w = 0; w < fds.size(); ++w) {
+			if (fds[w] < 0)
+				continue;
+			struct pollfd p;
+			p.fd = fds[w];
+			p.events = POLLIN;
+			p.revents = 0;
+			polled.push_back(p);
+			worker.push_back(w);
+		}
+		if (poll(&polled[0], polled.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("lli-synth: poll");
+			exit(1);
+		}
+		for (unsigned i = 0; i < polled.size(); ++i) {
+			if (polled[i].revents == 0)
+				continue;
+			unsigned w = worker[i];
+			char buf[4096];
+			ssize_t n = read(fds[w], buf, sizeof(buf));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n > 0) {
+				pending[w].append(buf, n);
+				size_t eol;
+				while ((eol = pending[w].find('\n')) != std::string::npos) {
+					bool last = false;
+					if (!ReceiveFromWorker(pending[w].substr(0, eol), last)) {
+						StopWorkers(pids, fds);
+						exit(254);
+					}
+					done[w] = done[w] || last;
+					pending[w].erase(0, eol + 1);
+				}
+				continue;
+			}
+
+			// the worker is gone
+			close(fds[w]);
+			fds[w] = -1;
+			--running;
+			int status = 0;
+			waitpid(pids[w], &status, 0);
+			int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+			if (code != 0 || !done[w]) {
+				// as a serial run would have ended here
+				if (code != 0)
+					dbgs() << "Worker " << w + 1 << " ended with exit status " << code << "\n";
+				StopWorkers(pids, fds);
+				exit(code);
+			}
+		}
+	}
+	return 0;
+}
+
+// The traces of -listen are run by workers that connect to lli-synth, on the
+// same host or others.  Every round lli-synth sends each worker its share:
+//   R round first share   the round, and the runs first + 1 to first + share
+//   A n, then n lines     the arguments of the program, its name first
+//   L n label ...         the label_instr of every instruction of the module
+//   V st ld traces        the coverage so far, one line per pair
+//   M bytes, then bytes   the module as it is now, in assembly
+// and, once the fences converged, E.  The worker answers as a worker of -j
+// (C, V, then S), or with X, on a new line, if the process that ran the
+// share failed.  The labels keep the clauses of every worker in the
+// numbering of the module here.
+
+// the connections of the workers of -listen
+static std::vector<int> RemoteFds;
+static std::vector<std::string> RemotePending;
+
+// IsInetAddr - Whether addr is host:port rather than the path of a Unix socket.
+static bool IsInetAddr(const std::string &addr) {
+	return addr.rfind(':') != std::string::npos && addr.find('/') == std::string::npos;
+}
+
+// OpenSocket - Listen at or connect to addr: the path of a Unix socket, or
+// host:port.  A worker that starts before lli-synth listens tries again.
+static int OpenSocket(const std::string &addr, bool listening) {
+	size_t colon = addr.rfind(':');
+	bool inet = IsInetAddr(addr);
+	int fd = -1;
+	for (unsigned tries = 0; fd < 0 && tries < 100; ++tries) {
+		if (tries > 0)
+			usleep(100000);
+		if (inet) {
+			std::string host = addr.substr(0, colon), port = addr.substr(colon + 1);
+			struct addrinfo hints, *res = 0;
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = listening ? AI_PASSIVE : 0;
+			int err = getaddrinfo(host.empty() ? 0 : host.c_str(), port.c_str(), &hints, &res);
+			if (err != 0) {
+				errs() << "lli-synth: " << addr << ": " << gai_strerror(err) << "\n";
+				exit(1);
+			}
+			for (struct addrinfo *ai = res; ai != 0 && fd < 0; ai = ai->ai_next) {
+				fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+				if (fd < 0)
+					continue;
+				int one = 1;
+				if (listening)
+					setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+				if ((listening ? bind(fd, ai->ai_addr, ai->ai_addrlen)
+				               : connect(fd, ai->ai_addr, ai->ai_addrlen)) != 0) {
+					close(fd);
+					fd = -1;
+				}
+			}
+			freeaddrinfo(res);
+		} else {
+			struct sockaddr_un sa;
+			memset(&sa, 0, sizeof(sa));
+			sa.sun_family = AF_UNIX;
+			if (addr.size() >= sizeof(sa.sun_path)) {
+				errs() << "lli-synth: " << addr << ": socket path too long\n";
+				exit(1);
+			}
+			strcpy(sa.sun_path, addr.c_str());
+			// a socket an earlier lli-synth left behind
+			struct stat st;
+			if (listening && stat(addr.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+				unlink(addr.c_str());
+			fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd >= 0 && (listening ? bind(fd, (struct sockaddr *)&sa, sizeof(sa))
+			                          : connect(fd, (struct sockaddr *)&sa, sizeof(sa))) != 0) {
+				close(fd);
+				fd = -1;
+			}
+		}
+		if (listening)
+			break;
+	}
+	if (fd < 0 || (listening && listen(fd, RemoteWorkers) != 0)) {
+		perror(("lli-synth: " + addr).c_str());
+		exit(1);
+	}
+	return fd;
+}
+
+// ReadMore - Append what fd has to pending; false at the end of the stream.
+static bool ReadMore(int fd, std::string &pending) {
+	char buf[4096];
+	ssize_t n;
+	do
+		n = read(fd, buf, sizeof(buf));
+	while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return false;
+	pending.append(buf, n);
+	return true;
+}
+
+// ReadLine - The next line of fd, without the newline.
+static bool ReadLine(int fd, std::string &pending, std::string &line) {
+	size_t eol;
+	while ((eol = pending.find('\n')) == std::string::npos)
+		if (!ReadMore(fd, pending))
+			return false;
+	line = pending.substr(0, eol);
+	pending.erase(0, eol + 1);
+	return true;
+}
+
+// ReadBytes - The next n bytes of fd.
+static bool ReadBytes(int fd, std::string &pending, size_t n, std::string &bytes) {
+	while (pending.size() < n)
+		if (!ReadMore(fd, pending))
+			return false;
+	bytes = pending.substr(0, n);
+	pending.erase(0, n);
+	return true;
+}
+
+// AcceptWorkers - Wait for the -workers workers of -listen.
+static void AcceptWorkers() {
+	signal(SIGPIPE, SIG_IGN);
+	int listenFd = OpenSocket(Listen, true);
+	dbgs() << "Waiting for " << RemoteWorkers << " workers at " << Listen << "\n";
+	while (RemoteFds.size() < RemoteWorkers) {
+		int fd = accept(listenFd, 0, 0);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("lli-synth: accept");
+			exit(1);
+		}
+		RemoteFds.push_back(fd);
+		RemotePending.push_back(std::string());
+		dbgs() << "Worker " << RemoteFds.size() << " connected\n";
+	}
+	close(listenFd);
+}
+
+// RemoveSocket - Remove the Unix socket -listen created.
+static void RemoveSocket() {
+	if (!Listen.empty() && !IsInetAddr(Listen))
+		unlink(Listen.c_str());
+}
+
+// EndWorkers - Let the workers of -listen go, the fences converged.
+static void EndWorkers() {
+	RemoveSocket();
+	for (unsigned w = 0; w < RemoteFds.size(); ++w) {
+		WriteAll(RemoteFds[w], "E\n");
+		close(RemoteFds[w]);
+	}
+	RemoteFds.clear();
+}
+
+// RunRemote - Run the traces of a round on the workers of -listen, as
+// RunWorkers does on forked ones.
+static int RunRemote(Module* Mod, int RetryTime) {
+	static int round = 0;
+	// the runs of the workers go on from those of the last round
+	static unsigned first = 0;
+	++round;
+	SetProgramArgs();
+
+	std::ostringstream common;
+	common << "A " << InputArgv.size() << '\n';
+	for (unsigned i = 0; i < InputArgv.size(); ++i)
+		common << InputArgv[i] << '\n';
+	std::vector<int> labels;
+	for (Module::iterator F = Mod->begin(), FE = Mod->end(); F != FE; ++F)
+		for (Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB)
+			for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I)
+				labels.push_back(I->label_instr);
+	common << "L " << labels.size();
+	for (unsigned i = 0; i < labels.size(); ++i)
+		common << ' ' << labels[i];
+	common << '\n';
+	const std::map<tso_constraint_pair, int> &covered = constraintsHandler.GetCoverageMap();
+	for (std::map<tso_constraint_pair, int>::const_iterator it = covered.begin();
+	     it != covered.end(); ++it)
+		common << "V " << it->first.first << ' ' << it->first.second << ' '
+		       << it->second << '\n';
+	std::string ir;
+	raw_string_ostream irStream(ir);
+	irStream << *Mod;
+	irStream.flush();
+	common << "M " << ir.size() << '\n' << ir;
+
+	std::vector<bool> done(RemoteFds.size(), true);
+	unsigned running = 0;
+	for (unsigned w = 0; w < RemoteFds.size(); ++w) {
+		unsigned share = RetryTime / RemoteFds.size() +
+			(w < RetryTime % RemoteFds.size() ? 1 : 0);
+		if (share == 0)
+			continue;
+		std::ostringstream header;
+		header << "R " << round << ' ' << first << ' ' << share << '\n';
+		WriteAll(RemoteFds[w], header.str() + common.str());
+		done[w] = false;
+		++running;
+		first += share;
+	}
+
+	while (running > 0) {
+		std::vector<struct pollfd> polled;
+		std::vector<unsigned> worker;
+		for (unsigned w = 0; w < RemoteFds.size(); ++w) {
+			if (done[w])
+				continue;
+			struct pollfd p;
+			p.fd = RemoteFds[w];
+			p.events = POLLIN;
+			p.revents = 0;
+			polled.push_back(p);
+			worker.push_back(w);
+		}
+		if (poll(&polled[0], polled.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("lli-synth: poll");
+			exit(1);
+		}
+		for (unsigned i = 0; i < polled.size(); ++i) {
+			if (polled[i].revents == 0)
+				continue;
+			unsigned w = worker[i];
+			std::string &pending = RemotePending[w];
+			if (!ReadMore(RemoteFds[w], pending)) {
+				dbgs() << "Worker " << w + 1 << " closed its connection\n";
+				RemoveSocket();
+				exit(1);
+			}
+			size_t eol;
+			while (!done[w] && (eol = pending.find('\n')) != std::string::npos) {
+				std::string line = pending.substr(0, eol);
+				pending.erase(0, eol + 1);
+				// X starts a line of its own, after what a failed process left
+				if (line.empty())
+					continue;
+				if (line[0] == 'X') {
+					// as a serial run would have ended here
+					int code = atoi(line.c_str() + 2);
+					dbgs() << "Worker " << w + 1 << " ended with exit status " << code << "\n";
+					RemoveSocket();
+					exit(code);
+				}
+				bool last = false;
+				if (!ReceiveFromWorker(line, last)) {
+					RemoveSocket();
+					exit(254);
+				}
+				if (last) {
+					done[w] = true;
+					--running;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+// RunRemoteWorker - Run the shares of the rounds lli-synth at -connect sends,
+// each in a forked process that reports to lli-synth directly, until the
+// fences converged.
+static int RunRemoteWorker(LLVMContext &Context, char** argv, char* const* envp) {
+	signal(SIGPIPE, SIG_IGN);
+	int fd = OpenSocket(Connect, false);
+	// what the shares run depends on conf.txt here
+	Params::processInputFile();
+
+	std::string pending, line;
+	while (ReadLine(fd, pending, line) && line != "E") {
+		int round = 0;
+		unsigned first = 0, share = 0;
+		char kind = 0;
+		std::istringstream header(line);
+		header >> kind >> round >> first >> share;
+		std::vector<std::string> args;
+		std::vector<int> labels;
+		std::vector<std::pair<tso_constraint_pair, int> > covered;
+		std::string ir;
+		bool complete = kind == 'R';
+		while (complete && ReadLine(fd, pending, line)) {
+			std::istringstream in(line);
+			in >> kind;
+			unsigned n = 0;
+			if (kind == 'A') {
+				in >> n;
+				args.resize(n);
+				for (unsigned i = 0; i < n && complete; ++i)
+					complete = ReadLine(fd, pending, args[i]);
+			} else if (kind == 'L') {
+				in >> n;
+				labels.resize(n);
+				for (unsigned i = 0; i < n; ++i)
+					in >> labels[i];
+			} else if (kind == 'V') {
+				int st, ld, traces;
+				in >> st >> ld >> traces;
+				covered.push_back(std::make_pair(tso_constraint_pair(st, ld), traces));
+			} else if (kind == 'M') {
+				in >> n;
+				complete = ReadBytes(fd, pending, n, ir);
+				break;
+			} else {
+				complete = false;
+			}
+		}
+		if (!complete || kind != 'M') {
+			errs() << argv[0] << ": malformed round from " << Connect << "\n";
+			return 1;
+		}
+		dbgs() << "/-----/ Round " << round << ": runs " << first + 1 << " to "
+		       << first + share << " /------/\n";
+
+		cout.flush();
+		fflush(stdout);
+		outs().flush();
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("lli-synth: fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			SMDiagnostic Err;
+			Module *Mod = ParseAssemblyString(ir.c_str(), 0, Err, Context);
+			if (!Mod) {
+				Err.Print(argv[0], errs());
+				exit(1);
+			}
+			unsigned k = 0;
+			for (Module::iterator F = Mod->begin(), FE = Mod->end(); F != FE; ++F)
+				for (Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB)
+					for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I, ++k)
+						I->label_instr = k < labels.size() ? labels[k] : 0;
+			if (k != labels.size()) {
+				errs() << argv[0] << ": the module has " << k << " instructions, "
+				       << labels.size() << " labels\n";
+				exit(1);
+			}
+			constraintsHandler.SetupInstructionLabelMap(Mod);
+			for (unsigned i = 0; i < covered.size(); ++i)
+				constraintsHandler.AddCoverage(covered[i].first, covered[i].second);
+			InputArgv.assign(args.begin(), args.end());
+			HasProgramName = true;
+			WorkerPipe = fd;
+			exit(RunShare(Mod, first, share, argv, envp, Context, true));
+		}
+		int status = 0;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+		int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		if (code != 0) {
+			// the process may have died in the middle of a line
+			std::ostringstream failed;
+			failed << "\nX " << code << '\n';
+			WriteAll(fd, failed.str());
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+// the clauses a thread of -threads collects before it hands them over, unless
+// a round budget needs its count of instructions after every trace
+static const unsigned ClauseBatch = 8;
+
+// SharedRound - What the threads of -threads share, under Lock: the clauses
+// they found, which the main thread takes into the solver meanwhile, and the
+// round budget.
+struct SharedRound {
+	pthread_mutex_t Lock;
+	pthread_cond_t Changed;              // clauses were queued or a thread ended
+	std::deque<ReorderedPairs> Clauses;
+	unsigned Running;
+	unsigned long Steps;
+	time_t Start;
+	bool Exhausted;                      // the round budget ran out
+	volatile bool Stop;                  // the threads end after their trace
+};
+
+// InterpThread - An interpreter of -threads with its share of the traces of a
+// round, and what it counted.
+struct InterpThread {
+	SharedRound *Round;
+	Interpreter *Interp;
+	Constraints *Constr;   // where the reorderings of its traces go
+	Function *Entry;
+	char * const *Envp;
+	bool ToSolver;
+	unsigned Share;
+	unsigned Traces;
+	unsigned Livelocks;
+	clock_t Checking;
+	pthread_t Id;
+};
+
+// HandOver - Queue the clauses of a thread and count its instructions towards
+// the round budget; returns whether the round is over.
+static bool HandOver(SharedRound &R, std::vector<ReorderedPairs> &batch,
+                     unsigned long &steps) {
+	pthread_mutex_lock(&R.Lock);
+	R.Clauses.insert(R.Clauses.end(), batch.begin(), batch.end());
+	R.Steps += steps;
+	if ((Params::roundSteps > 0 && R.Steps >= Params::roundSteps) ||
+	    (Params::roundTime > 0 && difftime(time(0), R.Start) >= Params::roundTime)) {
+		R.Exhausted = true;
+		R.Stop = true;
+	}
+	bool stop = R.Stop;
+	pthread_cond_signal(&R.Changed);
+	pthread_mutex_unlock(&R.Lock);
+	batch.clear();
+	steps = 0;
+	return stop;
+}
+
+// RunInterpThread - A thread of -threads: the runs of main of its share, as
+// InterpretRun makes them.
+static void *RunInterpThread(void *arg) {
+	InterpThread &T = *(InterpThread *)arg;
+	SharedRound &R = *T.Round;
+	Interpreter *Intep = T.Interp;
+	bool budget = Params::roundSteps > 0 || Params::roundTime > 0;
+	std::vector<ReorderedPairs> batch;
+	unsigned long steps = 0;
+	bool stop = false;
+
+	for (unsigned i = 0; i < T.Share && !stop && !R.Stop; ++i) {
+		// the interpreter was created for the round, its first run is fresh
+		if (i > 0)
+			Intep->reset();
+		errno = 0;
+		Intep->runMain = false;
+		Intep->runStaticConstructorsDestructors(false);
+		Intep->toFix = T.ToSolver;
+		Intep->segmentFaultFlag = false;
+		Intep->runMain = true;
+		Intep->runFunctionAsMain(T.Entry, InputArgv, T.Envp);
+		Intep->runMain = false;
+		Intep->runStaticConstructorsDestructors(true);
+
+		T.Traces++;
+		T.Checking += Intep->getCheckingTime();
+		steps += Intep->getTraceSteps();
+		if (Intep->ExitStatus == 253)
+			batch.push_back(T.Constr->GetClausePairs());
+		else if (Intep->ExitStatus == 252)
+			T.Livelocks++;
+		if (budget || batch.size() >= ClauseBatch)
+			stop = HandOver(R, batch, steps);
+	}
+
+	pthread_mutex_lock(&R.Lock);
+	R.Clauses.insert(R.Clauses.end(), batch.begin(), batch.end());
+	R.Steps += steps;
+	R.Running--;
+	pthread_cond_signal(&R.Changed);
+	pthread_mutex_unlock(&R.Lock);
+	return 0;
+}
+
+// RunThreads - Run the traces of a round on -threads interpreters of the
+// module at once, each in a thread with its share of the traces, its own run
+// numbers and its own Constraints.  The module is read-only while they run:
+// the intrinsics are lowered up front, the fences go in between rounds.
+// The clauses of the buggy traces go into the solver here as the threads
+// hand them over.
+static int RunThreads(Module* Mod, int RetryTime, char** argv, char* const* envp,
+                      LLVMContext &Context, bool toSolver) {
+	Function *EntryFn = Mod->getFunction(EntryFunc);
+	if (!EntryFn) {
+		errs() << '\'' << EntryFunc << "\' function not found in module.\n";
+		return -1;
+	}
+	// what InterpretRun adds on the first run, added before the threads start
+	Mod->getOrInsertFunction("exit", Type::getVoidTy(Context),
+	                         Type::getInt32Ty(Context), NULL);
+	SetProgramArgs();
+
+	SharedRound R;
+	pthread_mutex_init(&R.Lock, 0);
+	pthread_cond_init(&R.Changed, 0);
+	R.Running = 0;
+	R.Steps = 0;
+	R.Start = time(0);
+	R.Exhausted = false;
+	R.Stop = false;
+
+	// the interpreters are created here: each reads conf.txt and registers
+	// the external functions
+	std::map<tso_constraint_pair, int> covered = constraintsHandler.GetCoverageMap();
+	std::vector<InterpThread> threads;
+	for (unsigned t = 0; t < Threads; ++t) {
+		unsigned share = RetryTime / Threads + (t < RetryTime % Threads ? 1 : 0);
+		if (share == 0)
+			continue;
+		InterpThread T;
+		T.Round = &R;
+		T.Interp = (Interpreter*)CreateEngine(Mod, argv);
+		T.Constr = new Constraints();
+		for (std::map<tso_constraint_pair, int>::const_iterator it = covered.begin();
+		     it != covered.end(); ++it)
+			T.Constr->AddCoverage(it->first, it->second);
+		T.Interp->setConstraints(T.Constr);
+		T.Entry = EntryFn;
+		T.Envp = envp;
+		T.ToSolver = toSolver;
+		T.Share = share;
+		T.Traces = 0;
+		T.Livelocks = 0;
+		T.Checking = 0;
+		threads.push_back(T);
+	}
+	threads[0].Interp->lowerIntrinsics();
+	if (!llvm_is_multithreaded())
+		llvm_start_multithreaded();
+
+	ThreadsRunning = true;
+	R.Running = threads.size();
+	for (unsigned t = 0; t < threads.size(); ++t) {
+		if (pthread_create(&threads[t].Id, 0, RunInterpThread, &threads[t]) != 0) {
+			perror("lli-synth: pthread_create");
+			exit(1);
+		}
+	}
+
+	bool noLits = false;
+	pthread_mutex_lock(&R.Lock);
+	while (true) {
+		while (!R.Clauses.empty()) {
+			ReorderedPairs pairs;
+			pairs.swap(R.Clauses.front());
+			R.Clauses.pop_front();
+			if (noLits)
+				continue;
+			pthread_mutex_unlock(&R.Lock);
+			if (!TakeClause(pairs)) {
+				// as a serial run would have ended here, once the threads did
+				noLits = true;
+				R.Stop = true;
+			}
+			pthread_mutex_lock(&R.Lock);
+		}
+		if (R.Running == 0)
+			break;
+		pthread_cond_wait(&R.Changed, &R.Lock);
+	}
+	pthread_mutex_unlock(&R.Lock);
+
+	for (unsigned t = 0; t < threads.size(); ++t)
+		pthread_join(threads[t].Id, 0);
+	ThreadsRunning = false;
+	pthread_cond_destroy(&R.Changed);
+	pthread_mutex_destroy(&R.Lock);
+	if (noLits)
+		exit(254);
+
+	for (unsigned t = 0; t < threads.size(); ++t) {
+		InterpThread &T = threads[t];
+		total_traces += T.Traces;
+		livelock_traces += T.Livelocks;
+		timeofChecking += T.Checking;
+		const std::map<tso_constraint_pair, int> &now = T.Constr->GetCoverageMap();
+		for (std::map<tso_constraint_pair, int>::const_iterator it = now.begin();
+		     it != now.end(); ++it) {
+			int traces = it->second - covered[it->first];
+			if (traces != 0)
+				constraintsHandler.AddCoverage(it->first, traces);
+		}
+		T.Interp->removeModule(Mod);
+		delete T.Interp;
+		delete T.Constr;
+	}
+	if (R.Exhausted)
+		dbgs() << "Round budget exhausted after " << total_traces << " traces and "
+		       << R.Steps << " instructions\n";
+	return 0;
+}
+
+int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
+									LLVMContext &Context, bool toSolver) { 
+   double average_lits = 0.0;
+   double accumul_lits = 0.0;
+   unsigned long round_steps = 0;
+   time_t round_start = time(0);
+
+   // the program may have changed since the last round: explore it anew
+   DPORExplorer::get().restart();
+   TracePredictor::get().restart();
+   BoundedExplorer::get().restart();
+
+   // the interpreter runs every trace of a round, but the fences of the last
+   // round changed the module it decoded
+   if (EE != 0 && ForceInterpreter) {
+	EE->removeModule(Mod);
+	delete EE;
+	EE = 0;
+   }
+
+   // DPOR and BOUNDED explore one tree of schedules, which -j would only repeat
+   if (!RemoteFds.empty() && ForceInterpreter &&
+       Params::Scheduler != DPOR && Params::Scheduler != BOUNDED)
+	return RunRemote(Mod, RetryTime);
+   if (Jobs > 1 && WorkerPipe < 0 && ForceInterpreter &&
+       Params::Scheduler != DPOR && Params::Scheduler != BOUNDED)
+	return RunWorkers(Mod, RetryTime, argv, envp, Context, toSolver);
+   // nor can the threads of -threads share the state PREDICTIVE keeps
+   if (Threads > 1 && ForceInterpreter && Params::Scheduler != DPOR &&
+       Params::Scheduler != BOUNDED && Params::Scheduler != PREDICTIVE)
+	return RunThreads(Mod, RetryTime, argv, envp, Context, toSolver);
+
+   // the checker of -pipeline; DPOR, BOUNDED and PREDICTIVE decide the next
+   // trace from the check of the last one
+   TraceChecker *checker = 0;
+   if (Pipeline > 0 && ForceInterpreter && toSolver && Params::Scheduler != DPOR &&
+       Params::Scheduler != BOUNDED && Params::Scheduler != PREDICTIVE) {
+	checker = new TraceChecker(Pipeline);
+	ThreadsRunning = true;
+   }
+
+   // BOUNDED runs until the bound is exhausted rather than -try traces
+   while ((total_traces < RetryTime || Params::Scheduler == BOUNDED)) {// || (average_lits >= 5.0 * buggy_traces)) {
+	if (EE != 0 && ForceInterpreter) {
+		// back to the state right after it was created
+		((Interpreter*)EE)->reset();
+	} else {
+  	EE = CreateEngine(Mod, argv);
+	}
+
+	SetProgramArgs();
 
   	// Call the main function from M as if its signature were:
   	//   int main (int argc, char **argv, const char **envp)
@@ -230,6 +1175,7 @@ int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
 		Intep->segmentFaultFlag = false;
 		//Intep->allonAssertExist = false;
 		Intep->runMain = true;
+		Intep->setChecker(checker);
 	}
 
  	int Result = EE->runFunctionAsMain(EntryFn, InputArgv, envp);
@@ -254,11 +1200,50 @@ int InterpretRun(Module* Mod, int RetryTime, char** argv, char* const* envp,
 			if (constraintsHandler.GetLitSingleNumber() == 0) {
 				exit(254);
 			}
-			constraintsHandler.AddToSolver();
+			if (WorkerPipe >= 0)
+				SendClause(constraintsHandler.GetClausePairs());
+			else
+				constraintsHandler.AddToSolver();
 			//constraintsHandler.PrintConstraintInst(Mod);
+		} else if (Intep->ExitStatus == 252) {
+			livelock_traces++;
 		}
+		round_steps += Intep->getTraceSteps();
+		timeofChecking += Intep->getCheckingTime();
+		if (checker != 0)
+			TakeChecked(checker, false);
 	}
 	total_traces++;
+
+	if ((Params::roundSteps > 0 && round_steps >= Params::roundSteps) ||
+	    (Params::roundTime > 0 && difftime(time(0), round_start) >= Params::roundTime)) {
+		dbgs() << "Round budget exhausted after " << total_traces << " traces and "
+		       << round_steps << " instructions\n";
+		break;
+	}
+
+	// under DPOR, more traces would only repeat the explored classes
+	if (DPORExplorer::get().isComplete())
+		break;
+	if (Params::Scheduler == BOUNDED) {
+		if (buggy_traces > 0) {
+			// the first violation is enough for the fences of this round
+			dbgs() << "BOUNDED: violation found at bound "
+			       << BoundedExplorer::get().getBound() << " after " << total_traces
+			       << " traces (" << CSCounter << " context switches, "
+			       << PreemptiveCSCounter << " preemptive)\n";
+			break;
+		}
+		if (BoundedExplorer::get().isComplete())
+			break;
+	}
+    }
+    if (checker != 0) {
+	TakeChecked(checker, true);
+	if (EE != 0)
+		((Interpreter*)EE)->setChecker(0);
+	delete checker;
+	ThreadsRunning = false;
     }
     return 0;
 }
@@ -288,6 +1273,10 @@ int main(int argc, char **argv, char * const *envp) {
   if (DisableCoreFiles)
     sys::Process::PreventCoreFiles();
 
+  // a worker of another lli-synth gets the module from it
+  if (!Connect.empty())
+    return RunRemoteWorker(Context, argv, envp);
+
   // Load the bitcode...
   Module *Mod = NULL;
 
@@ -361,7 +1350,15 @@ int main(int argc, char **argv, char * const *envp) {
 	// make it more easier using label to index instruction 
 	constraintsHandler.SetupInstructionLabelMap(Mod);
 
+	// the workers of -j and the threads of -threads read conf.txt themselves,
+	// but what they run, and whether -pipeline checks, depends on it
+	if ((Jobs > 1 || Threads > 1 || Pipeline > 0 || !Listen.empty()) && ForceInterpreter)
+		Params::processInputFile();
+	if (!Listen.empty())
+		AcceptWorkers();
+
 	int round = 0;
+	int coveredBefore = 0;
 	while (1) {
 		round++;
 		
@@ -378,10 +1375,18 @@ int main(int argc, char **argv, char * const *envp) {
 		dbgs() << "/-----/ Execution completes /----------------------------------/\n";
 		dbgs() << "Try " << total_traces << " times," 
            << " find " << buggy_traces << " buggy traces\n";
+		if (livelock_traces > 0)
+			dbgs() << livelock_traces << " traces ran out of their budget (livelock candidates)\n";
+		if (Params::coverage) {
+			dbgs() << "Coverage: " << constraintsHandler.GetCoverage() << " reordered pairs, "
+             << constraintsHandler.GetCoverage() - coveredBefore << " new in this round\n";
+			coveredBefore = constraintsHandler.GetCoverage();
+		}
 		dbgs() << "Collect " << constraintsHandler.GetLitTotalNumber() << " lits and " 
 										 		 << buggy_traces << " clauses to SAT solver...\n\n"; 
 		if (buggy_traces == 0) {
 			dbgs() << "/-----/ Converged! /-----------------------------------------/\n\n";
+			EndWorkers();
 			break;
 		}
 		
@@ -393,11 +1398,16 @@ int main(int argc, char **argv, char * const *envp) {
 			constraintsHandler.PrintOrderedInst();
 		} else {
 			dbgs() << "/-----/ Can't find out solutions /-----------------------------/\n\n";
+			RemoveSocket();
 			return 1;
 		}
 		
 		dbgs() << "/-----/ Inserting fences to IR /-------------------------------/\n\n";
 		constraintsHandler.InsertFences(Mod);
+		if (ForceInterpreter && EE != 0) {
+			Interpreter* Intep = (Interpreter*)EE;
+			Intep->invalidateConstantPool();
+		}
 		
 		timeofSolving += clock() - start1;
 
@@ -405,6 +1415,7 @@ int main(int argc, char **argv, char * const *envp) {
 		// start to execute: start to put a loop here!
 		total_traces = 0;
 		buggy_traces = 0;
+		livelock_traces = 0;
 		constraintsHandler.Flush();
 	}
 
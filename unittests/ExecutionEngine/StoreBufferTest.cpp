@@ -0,0 +1,187 @@
+//===- StoreBufferTest.cpp - Unit tests for the DFENCE store buffers ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "../lib/ExecutionEngine/Interpreter/StoreBuffer.h"
+#include "gtest/gtest.h"
+
+using namespace llvm;
+
+namespace {
+
+GenericValue intValue(unsigned N) {
+  GenericValue V;
+  V.IntVal = APInt(32, N);
+  return V;
+}
+
+tso_buff_elem tsoStore(void *Addr, unsigned N, int Label) {
+  tso_buff_elem Elem;
+  Elem.pointer = GenericValue(Addr);
+  Elem.value = intValue(N);
+  Elem.type = 0;
+  Elem.label = Label;
+  return Elem;
+}
+
+TEST(TSOBufferTest, FlushesInProgramOrder) {
+  int X, Y;
+  TSOBuffer B;
+  EXPECT_TRUE(B.empty());
+
+  B.push_back(tsoStore(&X, 1, 10));
+  B.push_back(tsoStore(&Y, 2, 11));
+  B.push_back(tsoStore(&X, 3, 12));
+  EXPECT_EQ(3U, B.size());
+  EXPECT_EQ(3U, B.getNumStored());
+  EXPECT_EQ(0U, B.getNumFlushed());
+
+  EXPECT_EQ(10, B.front().label);
+  B.pop_front();
+  EXPECT_EQ(11, B.front().label);
+  EXPECT_EQ(&Y, B.front().pointer.PointerVal);
+  B.pop_front();
+  EXPECT_EQ(12, B.front().label);
+  B.pop_front();
+
+  EXPECT_TRUE(B.empty());
+  EXPECT_EQ(3U, B.getNumStored());
+  EXPECT_EQ(3U, B.getNumFlushed());
+}
+
+TEST(TSOBufferTest, ForwardsTheYoungestStore) {
+  int X, Y, Z;
+  TSOBuffer B;
+  B.push_back(tsoStore(&X, 1, 10));
+  B.push_back(tsoStore(&Y, 2, 11));
+  B.push_back(tsoStore(&X, 3, 12));
+
+  ASSERT_TRUE(B.findNewest(&X) != 0);
+  EXPECT_EQ(3U, B.findNewest(&X)->value.IntVal.getZExtValue());
+  ASSERT_TRUE(B.findNewest(&Y) != 0);
+  EXPECT_EQ(2U, B.findNewest(&Y)->value.IntVal.getZExtValue());
+  EXPECT_TRUE(B.findNewest(&Z) == 0);
+
+  // Flushing an older store to X leaves the younger one to forward from.
+  B.pop_front();
+  ASSERT_TRUE(B.findNewest(&X) != 0);
+  EXPECT_EQ(12, B.findNewest(&X)->label);
+
+  B.pop_front();
+  EXPECT_TRUE(B.findNewest(&Y) == 0);
+  B.pop_front();
+  EXPECT_TRUE(B.findNewest(&X) == 0);
+}
+
+TEST(TSOBufferTest, GrowsAcrossTheRingBoundary) {
+  int Addrs[40];
+  TSOBuffer B;
+
+  // Move the head into the ring so that growing has to unwrap it.
+  for (unsigned i = 0; i != 10; ++i)
+    B.push_back(tsoStore(&Addrs[i], i, i));
+  for (unsigned i = 0; i != 10; ++i)
+    B.pop_front();
+
+  for (unsigned i = 10; i != 40; ++i)
+    B.push_back(tsoStore(&Addrs[i], i, i));
+  EXPECT_EQ(30U, B.size());
+  EXPECT_EQ(40U, B.getNumStored());
+  EXPECT_EQ(10U, B.getNumFlushed());
+
+  for (unsigned i = 10; i != 40; ++i) {
+    ASSERT_TRUE(B.findNewest(&Addrs[i]) != 0);
+    EXPECT_EQ((int)i, B.findNewest(&Addrs[i])->label);
+  }
+  for (unsigned i = 10; i != 40; ++i) {
+    EXPECT_EQ((int)i, B.front().label);
+    EXPECT_EQ(i, B.front().value.IntVal.getZExtValue());
+    B.pop_front();
+  }
+  EXPECT_TRUE(B.empty());
+}
+
+TEST(PSOBufferTest, KeepsOneQueuePerAddress) {
+  int X, Y, Z;
+  PSOBuffer B;
+  EXPECT_TRUE(B.empty());
+  EXPECT_TRUE(B.empty(&X));
+
+  B.push_back(&X, intValue(1), 0, 10);
+  B.push_back(&Y, intValue(2), 0, 11);
+  B.push_back(&X, intValue(3), 0, 12);
+  EXPECT_FALSE(B.empty());
+  EXPECT_EQ(2U, B.size(&X));
+  EXPECT_EQ(1U, B.size(&Y));
+  EXPECT_EQ(0U, B.size(&Z));
+
+  // Each queue flushes in its own order, independently of the others.
+  EXPECT_EQ(11, B.front(&Y).label);
+  B.pop_front(&Y);
+  EXPECT_TRUE(B.empty(&Y));
+  EXPECT_EQ(10, B.front(&X).label);
+  B.pop_front(&X);
+  EXPECT_EQ(12, B.front(&X).label);
+  B.pop_front(&X);
+  EXPECT_TRUE(B.empty());
+
+  EXPECT_EQ(2U, B.getNumStored(&X));
+  EXPECT_EQ(2U, B.getNumFlushed(&X));
+  EXPECT_EQ(1U, B.getNumFlushed(&Y));
+  EXPECT_EQ(0U, B.getNumStored(&Z));
+}
+
+TEST(PSOBufferTest, ForwardsTheYoungestStore) {
+  int X, Y;
+  PSOBuffer B;
+  B.push_back(&X, intValue(1), 0, 10);
+  B.push_back(&X, intValue(2), 0, 11);
+
+  ASSERT_TRUE(B.findNewest(&X) != 0);
+  EXPECT_EQ(2U, B.findNewest(&X)->value.IntVal.getZExtValue());
+  EXPECT_TRUE(B.findNewest(&Y) == 0);
+
+  B.pop_front(&X);
+  ASSERT_TRUE(B.findNewest(&X) != 0);
+  EXPECT_EQ(11, B.findNewest(&X)->label);
+  B.pop_front(&X);
+  EXPECT_TRUE(B.findNewest(&X) == 0);
+}
+
+TEST(PSOBufferTest, ListsTheAddressesWithStores) {
+  int X, Y, Z;
+  PSOBuffer B;
+  B.push_back(&X, intValue(1), 0, 10);
+  B.push_back(&Y, intValue(2), 0, 11);
+  B.push_back(&Z, intValue(3), 0, 12);
+  ASSERT_EQ(3U, B.getNumAddresses());
+  EXPECT_EQ(&X, B.getAddress(0));
+  EXPECT_EQ(&Y, B.getAddress(1));
+  EXPECT_EQ(&Z, B.getAddress(2));
+
+  // Emptying a queue takes its address off the list; the last address moves
+  // into its place.
+  B.pop_front(&X);
+  ASSERT_EQ(2U, B.getNumAddresses());
+  EXPECT_EQ(&Z, B.getAddress(0));
+  EXPECT_EQ(&Y, B.getAddress(1));
+
+  // A store to a drained address lists it again, on the same queue.
+  B.push_back(&X, intValue(4), 0, 13);
+  ASSERT_EQ(3U, B.getNumAddresses());
+  EXPECT_EQ(&X, B.getAddress(2));
+  EXPECT_EQ(1U, B.getNumFlushed(&X));
+  EXPECT_EQ(2U, B.getNumStored(&X));
+
+  B.pop_front(&Y);
+  B.pop_front(&Z);
+  ASSERT_EQ(1U, B.getNumAddresses());
+  EXPECT_EQ(&X, B.getAddress(0));
+}
+
+}